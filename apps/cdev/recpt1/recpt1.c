@@ -1,4 +1,5 @@
 /* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+#define _GNU_SOURCE /* splice() */
 #include <stdio.h>
 #include <fcntl.h>
 #include <sys/types.h>
@@ -479,9 +480,9 @@ void
 show_usage(char *cmd)
 {
 #ifdef HAVE_LIBARIB25
-    fprintf(stderr, "Usage: \n%s [--b25 [--round N] [--strip] [--EMM]] [--udp [--addr hostname --port portnumber]] [--device devicefile] [--lnb voltage] [--sid SID1,SID2] channel rectime destfile\n", cmd);
+    fprintf(stderr, "Usage: \n%s [--b25 [--round N] [--strip] [--EMM]] [--udp [--addr hostname --port portnumber]] [--device devicefile] [--lnb voltage] [--sid SID1,SID2] [--splice] channel rectime destfile\n", cmd);
 #else
-    fprintf(stderr, "Usage: \n%s [--strip] [--EMM]] [--udp [--addr hostname --port portnumber]] [--device devicefile] [--lnb voltage] [--sid SID1,SID2] channel rectime destfile\n", cmd);
+    fprintf(stderr, "Usage: \n%s [--strip] [--EMM]] [--udp [--addr hostname --port portnumber]] [--device devicefile] [--lnb voltage] [--sid SID1,SID2] [--splice] channel rectime destfile\n", cmd);
 #endif
     fprintf(stderr, "\n");
     fprintf(stderr, "Remarks:\n");
@@ -505,6 +506,7 @@ show_options(void)
     fprintf(stderr, "--device devicefile: Specify devicefile to use\n");
     fprintf(stderr, "--lnb voltage:       Specify LNB voltage (0, 11, 15)\n");
     fprintf(stderr, "--sid SID1,SID2,...: Specify SID number in CSV format (101,102,...)\n");
+    fprintf(stderr, "--splice:            Move TS to destfile with splice(), no --b25, --udp or --sid\n");
     fprintf(stderr, "--help:              Show this help\n");
     fprintf(stderr, "--version:           Show version\n");
     fprintf(stderr, "--list:              Show channel list\n");
@@ -522,6 +524,52 @@ cleanup(thread_data *tdata)
     pthread_cond_signal(&tdata->queue->cond_used);
 }
 
+/* move TS from the tuner to the output file through a pipe, without copying it to user space */
+int
+splice_loop(thread_data *tdata)
+{
+    int pfd[2];
+    ssize_t rc, wc;
+    time_t cur_time;
+    boolean stopped = FALSE;
+
+    if(pipe(pfd) < 0) {
+        perror("pipe");
+        return -1;
+    }
+
+    while(1) {
+        rc = splice(tdata->tfd, NULL, pfd[1], NULL, MAX_READ_SIZE * 4, SPLICE_F_MOVE);
+        if(rc < 0 && errno != EAGAIN && errno != EINTR) {
+            perror("splice");
+            break;
+        }
+        while(rc > 0) {
+            wc = splice(pfd[0], NULL, tdata->wfd, NULL, rc, SPLICE_F_MOVE);
+            if(wc <= 0) {
+                perror("splice");
+                pthread_kill(tdata->signal_thread,
+                             errno == EPIPE ? SIGPIPE : SIGUSR2);
+                goto out;
+            }
+            rc -= wc;
+        }
+        if(f_exit || (stopped && rc <= 0))
+            break;
+
+        /* stop recording, then drain what is left */
+        time(&cur_time);
+        if(!stopped && (cur_time - tdata->start_time) >= tdata->recsec && !tdata->indefinite) {
+            ioctl(tdata->tfd, STOP_REC, 0);
+            stopped = TRUE;
+        }
+    }
+out:
+    close(pfd[0]);
+    close(pfd[1]);
+    return 0;
+}
+
 /* will be signal handler thread */
 void *
 process_signals(void *t)
@@ -623,6 +671,7 @@ main(int argc, char **argv)
         { "version",   0, NULL, 'v'},
         { "list",      0, NULL, 'l'},
         { "sid",       1, NULL, 'i'},
+        { "splice",    0, NULL, 'x'},
         {0, 0, NULL, 0} /* terminate */
     };
 
@@ -631,6 +680,7 @@ main(int argc, char **argv)
     boolean fileless = FALSE;
     boolean use_stdout = FALSE;
     boolean use_splitter = FALSE;
+    boolean use_splice = FALSE;
     char *host_to = NULL;
     int port_to = 1234;
     sock_data *sockdata = NULL;
@@ -639,7 +689,7 @@ main(int argc, char **argv)
     char *voltage[] = {"0V", "11V", "15V"};
     char *sid_list = NULL;
 
-    while((result = getopt_long(argc, argv, "br:smn:ua:p:d:hvli:",
+    while((result = getopt_long(argc, argv, "br:smn:ua:p:d:hvli:x",
                                 long_options, &option_index)) != -1) {
         switch(result) {
         case 'b':
@@ -715,9 +765,18 @@ main(int argc, char **argv)
             use_splitter = TRUE;
             sid_list = optarg;
             break;
+        case 'x':
+            use_splice = TRUE;
+            fprintf(stderr, "using splice\n");
+            break;
         }
     }
 
+    if(use_splice && (use_b25 || use_udp || use_splitter)) {
+        fprintf(stderr, "--splice cannot be used with --b25, --udp or --sid\n");
+        return 1;
+    }
+
     if(argc - optind < 3) {
         if(argc - optind == 2 && use_udp) {
             fprintf(stderr, "Fileless UDP broadcasting\n");
@@ -849,8 +908,14 @@ main(int argc, char **argv)
 
     time(&tdata.start_time);
 
+    if(use_splice) {
+        splice_loop(&tdata);
+        f_exit = TRUE;
+        enqueue(p_queue, NULL);
+    }
+
     /* read from tuner */
-    while(1) {
+    while(!use_splice) {
         if(f_exit)
             break;
 
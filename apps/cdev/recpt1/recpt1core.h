@@ -50,7 +50,7 @@ typedef struct sock_data {
     struct sockaddr_in addr;
 } sock_data;
 
-typedef struct msgbuf {
+typedef struct message_buf {
     long    mtype;
     char    mtext[MSGSZ];
 } message_buf;
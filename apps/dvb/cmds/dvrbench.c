@@ -0,0 +1,292 @@
+/*
+ * compare read() and mmap (DMX_REQBUFS) capture from a DVB demux.
+ * the stream is either the tuned frontend, or with -s a synthetic TS
+ * written to dvr0 by a child process (needs a demux with a memory frontend).
+ * example: ./dvrbench -s -n 512 ; ./dvrbench -s -m -n 512
+ */
+#include <linux/dvb/dmx.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TS_SIZE		188
+#define MAX_BUFS	32
+#define IDLE_MS		5000		/* give up when the stream stalls this long */
+
+static int adapter;
+static int use_mmap;
+static int synthetic;
+static unsigned long long total = 256ULL << 20;	/* bytes to capture */
+static unsigned int bufsz = TS_SIZE * 348;	/* ~64KB */
+static unsigned int nbufs = 8;
+static unsigned long long bad;			/* packets without sync byte */
+static unsigned long long cc_err;		/* synthetic stream: continuity counter jumps */
+static unsigned long long lost;			/* overflows / flagged buffers */
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-a adapter] [-m] [-s] [-n MB] [-b bufsize] [-c mmap buffers]\n"
+		" -m  capture with DMX_REQBUFS/DMX_DQBUF instead of read()\n"
+		" -s  feed a synthetic TS through dvr0 instead of the frontend\n", prog);
+	exit(1);
+}
+
+static void check(const unsigned char *p, unsigned int len)
+{
+	static int cc = -1;
+	unsigned int i;
+
+	for (i = 0; i + TS_SIZE <= len; i += TS_SIZE) {
+		if (p[i] != 0x47) {
+			bad++;
+			continue;
+		}
+		if (!synthetic || ((p[i + 1] & 0x1f) << 8 | p[i + 2]) != 0x100)
+			continue;
+		if (cc >= 0 && (p[i + 3] & 0xf) != ((cc + 1) & 0xf))
+			cc_err++;
+		cc = p[i + 3] & 0xf;
+	}
+}
+
+/*
+ * child: write null-ish packets on PID 0x100 with a running continuity counter
+ * until the parent kills it; dvr0 drops what does not fit, so there is no
+ * telling how much has to be written for the parent to get its total.
+ * opening dvr0 for writing switches the demux to the memory frontend, so the
+ * parent is told once that is done and sets its filter only then.
+ */
+static void writer(const char *dvr, int ready, int go)
+{
+	unsigned char buf[TS_SIZE * 348];
+	unsigned int i, cc = 0;
+	int fd = open(dvr, O_WRONLY);
+	char c = 0;
+
+	if (fd < 0) {
+		perror(dvr);
+		exit(1);
+	}
+	if (write(ready, &c, 1) != 1 || read(go, &c, 1) != 1)
+		exit(1);
+	memset(buf, 0xff, sizeof(buf));
+	for (;;) {
+		for (i = 0; i < sizeof(buf); i += TS_SIZE) {
+			buf[i] = 0x47;
+			buf[i + 1] = 0x01;
+			buf[i + 2] = 0x00;
+			buf[i + 3] = 0x10 | (cc++ & 0xf);
+		}
+		if (write(fd, buf, sizeof(buf)) != sizeof(buf)) {
+			perror("write");
+			exit(1);
+		}
+	}
+}
+
+/* 0 once nothing arrived for IDLE_MS, e.g. the writer died or the frontend lost lock */
+static int wait_data(int fd)
+{
+	struct pollfd pfd = {.fd = fd, .events = POLLIN};
+	int r;
+
+	do
+		r = poll(&pfd, 1, IDLE_MS);
+	while (r < 0 && errno == EINTR);
+	if (r < 0)
+		perror("poll");
+	else if (!r)
+		fprintf(stderr, "no data for %d ms\n", IDLE_MS);
+	return r > 0;
+}
+
+static unsigned long long capture_read(int fd)
+{
+	unsigned char *buf = malloc(bufsz);
+	unsigned long long got = 0;
+	ssize_t r;
+
+	if (!buf)
+		return 0;
+	while (got < total && wait_data(fd)) {
+		r = read(fd, buf, bufsz);
+		if (r < 0 && errno == EOVERFLOW) {
+			lost++;
+			continue;
+		}
+		if (r < 0) {
+			perror("read");
+			break;
+		}
+		check(buf, r);
+		got += r;
+	}
+	free(buf);
+	return got;
+}
+
+static unsigned long long capture_mmap(int fd)
+{
+	struct dmx_requestbuffers req = {.count = nbufs, .size = bufsz};
+	struct dmx_buffer b;
+	unsigned char *map[MAX_BUFS];
+	unsigned long long got = 0;
+	unsigned int i;
+
+	if (ioctl(fd, DMX_REQBUFS, &req) < 0) {
+		perror("DMX_REQBUFS (CONFIG_DVB_MMAP?)");
+		return 0;
+	}
+	for (i = 0; i < req.count; i++) {
+		memset(&b, 0, sizeof(b));
+		b.index = i;
+		if (ioctl(fd, DMX_QUERYBUF, &b) < 0) {
+			perror("DMX_QUERYBUF");
+			return 0;
+		}
+		map[i] = mmap(NULL, b.length, PROT_READ, MAP_SHARED, fd, b.offset);
+		if (map[i] == MAP_FAILED) {
+			perror("mmap");
+			return 0;
+		}
+		if (ioctl(fd, DMX_QBUF, &b) < 0) {
+			perror("DMX_QBUF");
+			return 0;
+		}
+	}
+	while (got < total && wait_data(fd)) {
+		memset(&b, 0, sizeof(b));
+		if (ioctl(fd, DMX_DQBUF, &b) < 0) {
+			perror("DMX_DQBUF");
+			break;
+		}
+		if (b.flags & (DMX_BUFFER_FLAG_DISCONTINUITY_DETECTED | DMX_BUFFER_PKT_COUNTER_MISMATCH))
+			lost++;
+		check(map[b.index], b.bytesused);
+		got += b.bytesused;
+		if (ioctl(fd, DMX_QBUF, &b) < 0) {
+			perror("DMX_QBUF");
+			break;
+		}
+	}
+	return got;
+}
+
+int main(int argc, char **argv)
+{
+	struct dmx_pes_filter_params pes = {
+		.pid = 0x2000,
+		.input = DMX_IN_FRONTEND,
+		.output = DMX_OUT_TSDEMUX_TAP,
+		.pes_type = DMX_PES_OTHER,
+		.flags = DMX_IMMEDIATE_START,
+	};
+	struct rusage ru0, ru1;
+	struct timeval t0, t1;
+	char dmx[64], dvr[64];
+	unsigned long long got;
+	pid_t child = 0;
+	double sec, cpu;
+	int c, fd, ready[2], go[2];
+	char sync = 0;
+
+	while ((c = getopt(argc, argv, "a:msn:b:c:h")) != -1) {
+		switch (c) {
+		case 'a':
+			adapter = atoi(optarg);
+			break;
+		case 'm':
+			use_mmap = 1;
+			break;
+		case 's':
+			synthetic = 1;
+			break;
+		case 'n':
+			total = strtoull(optarg, NULL, 0) << 20;
+			break;
+		case 'b':
+			bufsz = strtoul(optarg, NULL, 0) / TS_SIZE * TS_SIZE;
+			break;
+		case 'c':
+			nbufs = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!bufsz || !nbufs || nbufs > MAX_BUFS)
+		usage(argv[0]);
+	snprintf(dmx, sizeof(dmx), "/dev/dvb/adapter%d/demux0", adapter);
+	snprintf(dvr, sizeof(dvr), "/dev/dvb/adapter%d/dvr0", adapter);
+
+	fd = open(dmx, O_RDWR);
+	if (fd < 0) {
+		perror(dmx);
+		return 1;
+	}
+	if (!use_mmap && ioctl(fd, DMX_SET_BUFFER_SIZE, bufsz * MAX_BUFS) < 0)
+		perror("DMX_SET_BUFFER_SIZE");
+	if (synthetic) {
+		if (pipe(ready) < 0 || pipe(go) < 0) {
+			perror("pipe");
+			return 1;
+		}
+		child = fork();
+		if (child < 0) {
+			perror("fork");
+			return 1;
+		}
+		if (!child)
+			writer(dvr, ready[1], go[0]);
+		if (read(ready[0], &sync, 1) != 1) {	/* dvr0 open, demux on the memory frontend */
+			fprintf(stderr, "writer failed\n");
+			waitpid(child, NULL, 0);
+			return 1;
+		}
+	}
+	if (ioctl(fd, DMX_SET_PES_FILTER, &pes) < 0) {
+		perror("DMX_SET_PES_FILTER");
+		if (child) {
+			kill(child, SIGTERM);
+			waitpid(child, NULL, 0);
+		}
+		return 1;
+	}
+	if (synthetic && write(go[1], &sync, 1) != 1) {
+		perror("write");
+		return 1;
+	}
+
+	getrusage(RUSAGE_SELF, &ru0);
+	gettimeofday(&t0, NULL);
+	got = use_mmap ? capture_mmap(fd) : capture_read(fd);
+	gettimeofday(&t1, NULL);
+	getrusage(RUSAGE_SELF, &ru1);
+
+	if (child) {
+		kill(child, SIGTERM);
+		waitpid(child, NULL, 0);
+	}
+	close(fd);
+
+	sec = (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) / 1e6;
+	cpu = (ru1.ru_utime.tv_sec - ru0.ru_utime.tv_sec) + (ru1.ru_utime.tv_usec - ru0.ru_utime.tv_usec) / 1e6
+	    + (ru1.ru_stime.tv_sec - ru0.ru_stime.tv_sec) + (ru1.ru_stime.tv_usec - ru0.ru_stime.tv_usec) / 1e6;
+	printf("%s: %llu bytes in %.3f s, %.1f MB/s, cpu %.3f s (%.1f%%), %llu bad packets, %llu overflows",
+		use_mmap ? "mmap" : "read", got, sec, sec > 0 ? got / sec / (1 << 20) : 0,
+		cpu, sec > 0 ? cpu * 100 / sec : 0, bad, lost);
+	if (synthetic)
+		printf(", %llu cc errors", cc_err);
+	printf("\n");
+	return got < total;
+}
@@ -0,0 +1,189 @@
+/*
+ * tune several adapters at once and report the time each one takes to lock.
+ * each argument is adapter:frequency[:ts_id], frequency as in tune.c
+ * (terrestrial: Hz or channel no., BS/CS110: kHz or channel no.).
+ * with -s the adapters are tuned one after another for comparison.
+ * example: ./tunebench 0:1318000:0x40f1 1:1049480:0x4010 2:27 3:25
+ */
+#include <linux/dvb/frontend.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_FE	16
+
+struct fe {
+	int		adapter,
+			fd;
+	unsigned int	freq,
+			ts_id;
+	double		t0,
+			lock;		/* ms from DTV_TUNE, <0 if not locked */
+	unsigned int	status;
+};
+
+static struct fe fes[MAX_FE];
+static int nfe;
+static int serial;
+static int timeout_ms = 5000;
+static int repeat = 1;
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-s] [-t timeout_ms] [-r repeat] adapter:freq[:ts_id] ...\n"
+		" -s  tune one adapter after another instead of all at once\n", prog);
+	exit(1);
+}
+
+static double now_ms(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1e3 + tv.tv_usec / 1e3;
+}
+
+static int tune(struct fe *f)
+{
+	struct dtv_property prop[3];
+	struct dtv_properties props = {.num = 3, .props = prop};
+	struct dvb_frontend_event ev;
+
+	while (ioctl(f->fd, FE_GET_EVENT, &ev) == 0)	/* drop stale events */
+		;
+	memset(prop, 0, sizeof(prop));
+	prop[0].cmd = DTV_FREQUENCY;
+	prop[0].u.data = f->freq;
+	prop[1].cmd = DTV_STREAM_ID;
+	prop[1].u.data = f->ts_id;
+	prop[2].cmd = DTV_TUNE;
+	f->lock = -1;
+	f->status = 0;
+	f->t0 = now_ms();
+	if (ioctl(f->fd, FE_SET_PROPERTY, &props) < 0) {
+		perror("ioctl FE_SET_PROPERTY");
+		return -1;
+	}
+	return 0;
+}
+
+/* wait for lock or timeout on fes[first..first+n-1], using frontend events */
+static void wait_lock(int first, int n)
+{
+	struct pollfd pfd[MAX_FE];
+	struct dvb_frontend_event ev;
+	double end = now_ms() + timeout_ms;
+	int i, left = n;
+
+	for (i = 0; i < n; i++) {
+		pfd[i].fd = fes[first + i].fd;
+		pfd[i].events = POLLIN | POLLPRI;
+	}
+	while (left && now_ms() < end) {
+		if (poll(pfd, n, (int)(end - now_ms()) + 1) <= 0)
+			continue;
+		for (i = 0; i < n; i++) {
+			struct fe *f = &fes[first + i];
+
+			if (!(pfd[i].revents & (POLLIN | POLLPRI)))
+				continue;
+			while (ioctl(f->fd, FE_GET_EVENT, &ev) == 0) {
+				f->status = ev.status;
+				if (pfd[i].fd < 0)
+					continue;
+				if (ev.status & FE_HAS_LOCK)
+					f->lock = now_ms() - f->t0;
+				if (ev.status & (FE_HAS_LOCK | FE_TIMEDOUT)) {
+					pfd[i].fd = -1;		/* done with this one */
+					left--;
+				}
+			}
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	double wall, sum[MAX_FE] = {0}, min[MAX_FE], max[MAX_FE];
+	int ok[MAX_FE] = {0};
+	char file[64];
+	int c, i, r;
+
+	while ((c = getopt(argc, argv, "st:r:h")) != -1) {
+		switch (c) {
+		case 's':
+			serial = 1;
+			break;
+		case 't':
+			timeout_ms = atoi(optarg);
+			break;
+		case 'r':
+			repeat = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind >= argc || argc - optind > MAX_FE || repeat < 1)
+		usage(argv[0]);
+	for (; optind < argc; optind++, nfe++) {
+		struct fe *f = &fes[nfe];
+		char *p = argv[optind];
+
+		f->adapter = strtol(p, &p, 0);
+		if (*p++ != ':')
+			usage(argv[0]);
+		f->freq = strtoul(p, &p, 0);
+		f->ts_id = *p == ':' ? strtoul(p + 1, NULL, 0) : 0;
+		snprintf(file, sizeof(file), "/dev/dvb/adapter%d/frontend0", f->adapter);
+		f->fd = open(file, O_RDWR | O_NONBLOCK);
+		if (f->fd < 0) {
+			perror(file);
+			return 1;
+		}
+		min[nfe] = 1e9;
+		max[nfe] = 0;
+	}
+
+	for (r = 0; r < repeat; r++) {
+		wall = now_ms();
+		if (serial) {
+			for (i = 0; i < nfe; i++)
+				if (!tune(&fes[i]))
+					wait_lock(i, 1);
+		} else {
+			for (i = 0; i < nfe; i++)
+				tune(&fes[i]);
+			wait_lock(0, nfe);
+		}
+		wall = now_ms() - wall;
+		for (i = 0; i < nfe; i++) {
+			struct fe *f = &fes[i];
+
+			if (f->lock >= 0) {
+				printf("#%d adapter%d %u: locked in %.1f ms\n", r, f->adapter, f->freq, f->lock);
+				ok[i]++;
+				sum[i] += f->lock;
+				if (f->lock < min[i])
+					min[i] = f->lock;
+				if (f->lock > max[i])
+					max[i] = f->lock;
+			} else
+				printf("#%d adapter%d %u: no lock, status 0x%02X\n", r, f->adapter, f->freq, f->status);
+		}
+		printf("#%d %s: all done in %.1f ms\n", r, serial ? "serial" : "parallel", wall);
+	}
+	if (repeat > 1)
+		for (i = 0; i < nfe; i++)
+			if (ok[i])
+				printf("adapter%d: %d/%d locked, min %.1f avg %.1f max %.1f ms\n",
+					fes[i].adapter, ok[i], repeat, min[i], sum[i] / ok[i], max[i]);
+	for (i = 0; i < nfe; i++)
+		close(fes[i].fd);
+	return 0;
+}
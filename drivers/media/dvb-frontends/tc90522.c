@@ -13,10 +13,107 @@
 	GNU General Public License for more details.
  */
 
+#include <linux/debugfs.h>
 #include <linux/int_log.h>
 #include <media/dvb_frontend.h>
 #include "tc90522.h"
 
+static uint stat_ms = 1000;
+module_param(stat_ms, uint, 0644);
+MODULE_PARM_DESC(stat_ms, "Signal statistics sampling interval while locked, 0: read on demand (default 1000)");
+
+enum tc90522_const {
+	TC90522_LOCK_MS		= 2000,		/* lock wait after the tuner PLL has been programmed	*/
+	TC90522_FAST_MS		= 64,		/* poll every jiffy until then, then back off		*/
+	TC90522_SLOW_MS		= 50,		/* longest poll interval				*/
+	TC90522_TSID_MS		= 400,		/* ISDB-S: carrier lock without TSID table, give up	*/
+	TC90522_TSID_MISS	= 2,		/* ISDB-S: TSID tables without the wanted TS, give up	*/
+	TC90522_FREQ_CNT	= 64,
+};
+
+struct tc90522_lstat {
+	u64	tunes,
+		locks,
+		aborts,		/* no signal, retryov or TS not found */
+		ms_sum;		/* of successful locks */
+	u32	ms_min,
+		ms_max,
+		ms_last;
+};
+
+struct tc90522 {
+	enum fe_status	festat;
+	bool		wait;		/* lock wait in progress, polled from the frontend thread */
+	u8		miss;
+	u32		locked;		/* frequency the tuner is locked to, 0 if none */
+	u64		fast;		/* retunes done without reprogramming the tuner */
+	unsigned long	timeout;
+	ktime_t		start,
+			carrier;	/* ISDB-S carrier lock seen */
+	u16		cn;		/* last sampled raw CNR */
+	struct dvb_frontend	*fe;
+	struct delayed_work	stat;	/* signal statistics sampler */
+	struct tc90522_lstat	sys[2];		/* ISDB-T, ISDB-S */
+	u32			nfreq;
+	struct {
+		u32			freq;
+		struct tc90522_lstat	st;
+	} freq[TC90522_FREQ_CNT];
+};
+
+static struct tc90522_lstat *tc90522_lstat_freq(struct tc90522 *t, u32 freq)
+{
+	u32 i, n = min_t(u32, t->nfreq, TC90522_FREQ_CNT);
+
+	for (i = 0; i < n; i++)
+		if (t->freq[i].freq == freq)
+			return &t->freq[i].st;
+	i = t->nfreq++ % TC90522_FREQ_CNT;			/* full: recycle the oldest entry */
+	memset(&t->freq[i].st, 0, sizeof(t->freq[i].st));
+	t->freq[i].freq = freq;
+	return &t->freq[i].st;
+}
+
+static void tc90522_lstat_add(struct tc90522_lstat *st, int ret, u32 ms)
+{
+	st->tunes++;
+	if (ret < 0) {
+		st->aborts += ret == -ECANCELED;
+		return;
+	}
+	st->locks++;
+	st->ms_sum	+= ms;
+	st->ms_last	= ms;
+	st->ms_max	= max(st->ms_max, ms);
+	st->ms_min	= st->locks == 1 ? ms : min(st->ms_min, ms);
+}
+
+static void tc90522_lstat_show(struct seq_file *m, const char *name, struct tc90522_lstat *st)
+{
+	seq_printf(m, "%-12s %8llu %8llu %8llu %8llu %6u %6llu %6u %6u\n", name, st->tunes, st->locks, st->aborts,
+		st->tunes - st->locks - st->aborts, st->ms_min, st->locks ? div64_u64(st->ms_sum, st->locks) : 0,
+		st->ms_max, st->ms_last);
+}
+
+static int tc90522_lock_stats_show(struct seq_file *m, void *v)
+{
+	struct tc90522	*t	= m->private;
+	char		name[16];
+	u32		i;
+
+	seq_printf(m, "%-12s %8s %8s %8s %8s %6s %6s %6s %6s\n", "", "tunes", "locks", "aborts", "timeouts",
+		"min", "avg", "max", "last");
+	tc90522_lstat_show(m, "ISDB-T", &t->sys[0]);
+	tc90522_lstat_show(m, "ISDB-S", &t->sys[1]);
+	seq_printf(m, "%-12s %8llu\n", "fast retune", t->fast);
+	for (i = 0; i < min_t(u32, t->nfreq, TC90522_FREQ_CNT); i++) {
+		snprintf(name, sizeof(name), "%u", t->freq[i].freq);
+		tc90522_lstat_show(m, name, &t->freq[i].st);
+	}
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(tc90522_lock_stats);
+
 static bool tc90522_r(struct i2c_client *c, u8 slvadr, u8 *buf, u8 len)
 {
 	struct i2c_msg msg[] = {
@@ -60,9 +157,9 @@ static int tc90522_cn_raw(struct dvb_frontend *fe, u16 *raw)	/* for DVBv3 compat
 	return cn;
 }
 
-static int tc90522_status(struct dvb_frontend *fe, enum fe_status *stat)
+static void tc90522_cnr(struct dvb_frontend *fe)
 {
-	enum fe_status			*festat	= i2c_get_clientdata(fe->demodulator_priv);
+	struct tc90522			*t	= i2c_get_clientdata(fe->demodulator_priv);
 	struct dtv_frontend_properties	*c	= &fe->dtv_property_cache;
 	u16	v16;
 	s64	raw	= tc90522_cn_raw(fe, &v16),
@@ -95,11 +192,95 @@ static int tc90522_status(struct dvb_frontend *fe, enum fe_status *stat)
 		return y >> 22;
 	}
 
-	c->cnr.len		= 1;
+	c->cnr.len = 1;
+	if (raw < 0) {
+		c->cnr.stat[0].scale = FE_SCALE_NOT_AVAILABLE;
+		return;
+	}
+	t->cn			= raw;
 	c->cnr.stat[0].svalue	= fe->dtv_property_cache.delivery_system == SYS_ISDBS ? cn_s() : cn_t();
 	c->cnr.stat[0].scale	= FE_SCALE_DECIBEL;
-	*stat = *festat;
-	return *festat;
+}
+
+static void tc90522_stat_clear(struct dtv_frontend_properties *c)
+{
+	struct dtv_fe_stats	*s[]	= {&c->strength, &c->cnr, &c->pre_bit_error, &c->pre_bit_count,
+					   &c->post_bit_error, &c->post_bit_count, &c->block_error, &c->block_count};
+	u8			i;
+
+	for (i = 0; i < ARRAY_SIZE(s); i++) {
+		s[i]->len		= 1;
+		s[i]->stat[0].scale	= FE_SCALE_NOT_AVAILABLE;
+	}
+}
+
+/*
+ * BER after Viterbi, i.e. before RS, per layer: ISDB-S 0xEB- {err:3 cnt:2} x2, ISDB-T 0x9D- err:3 x3 + cnt:2 x3
+ * cnt is in 204 byte packets, the registers hold one measurement period and are summed up here,
+ * the counters restart on retune. Pre-Viterbi BER and RS block errors are not available from the demodulator,
+ * they stay FE_SCALE_NOT_AVAILABLE as set on retune.
+ * Strength comes from the AGC gain, ISDB-S 0xBA (7 bits), ISDB-T IF AGC 0x82: the more gain, the weaker
+ */
+static void tc90522_sample(struct dvb_frontend *fe)
+{
+	struct i2c_client		*i	= fe->demodulator_priv;
+	struct dtv_frontend_properties	*c	= &fe->dtv_property_cache;
+	bool	isdbs	= c->delivery_system == SYS_ISDBS;
+	u8	buf[15],
+		n	= isdbs ? 2 : 3,
+		l;
+	u64	err	= 0,
+		cnt	= 0;
+	u32	agc_max	= isdbs ? 0x7F : 0xFF;
+
+	tc90522_cnr(fe);
+	if (tc90522_r(i, isdbs ? 0xEB : 0x9D, buf, n * 5)) {	/* on failure keep the totals so far */
+		for (l = 0; l < n; l++) {
+			err += tc90522_n2int(isdbs ? buf + l * 5 : buf + l * 3, 3);
+			cnt += tc90522_n2int(isdbs ? buf + l * 5 + 3 : buf + 9 + l * 2, 2) * 204 * 8;
+		}
+		if (c->post_bit_error.stat[0].scale != FE_SCALE_COUNTER)
+			c->post_bit_error.stat[0].uvalue = c->post_bit_count.stat[0].uvalue = 0;
+		c->post_bit_error.stat[0].uvalue	+= err;
+		c->post_bit_error.stat[0].scale		= FE_SCALE_COUNTER;
+		c->post_bit_count.stat[0].uvalue	+= cnt;
+		c->post_bit_count.stat[0].scale		= FE_SCALE_COUNTER;
+	}
+	if (tc90522_r(i, isdbs ? 0xBA : 0x82, buf, 1)) {
+		c->strength.stat[0].uvalue	= (agc_max - (buf[0] & agc_max)) * 0xFFFF / agc_max;
+		c->strength.stat[0].scale	= FE_SCALE_RELATIVE;
+	}
+}
+
+static void tc90522_stat_work(struct work_struct *work)
+{
+	struct tc90522 *t = container_of(to_delayed_work(work), struct tc90522, stat);
+
+	if (!t->locked || t->wait)			/* re-armed on the next lock */
+		return;
+	tc90522_sample(t->fe);
+	if (stat_ms)
+		schedule_delayed_work(&t->stat, msecs_to_jiffies(stat_ms));
+}
+
+static int tc90522_status(struct dvb_frontend *fe, enum fe_status *stat)
+{
+	struct tc90522 *t = i2c_get_clientdata(fe->demodulator_priv);
+
+	if (!stat_ms)
+		tc90522_cnr(fe);			/* no sampler, otherwise answered from the property cache */
+	*stat = t->festat;
+	return t->festat;
+}
+
+static int tc90522_read_snr(struct dvb_frontend *fe, u16 *raw)
+{
+	struct tc90522 *t = i2c_get_clientdata(fe->demodulator_priv);
+
+	if (!stat_ms || !t->locked)
+		return tc90522_cn_raw(fe, raw);
+	*raw = t->cn;
+	return t->cn;
 }
 
 static enum dvbfe_algo tc90522_get_frontend_algo(struct dvb_frontend *fe)
@@ -150,68 +331,128 @@ static int tc90522_tune(struct dvb_frontend *fe, bool retune, u32 mode_flags, u3
 	}
 
 	struct i2c_client	*c	= fe->demodulator_priv;
-	enum fe_status		*festat	= i2c_get_clientdata(c);
-	u16			set_id	= fe->dtv_property_cache.stream_id,
-				cnt	= 999;
+	struct tc90522		*t	= i2c_get_clientdata(c);
+	u16			set_id	= fe->dtv_property_cache.stream_id;
 	u8			data[16];
+	bool			isdbs	= fe->dtv_property_cache.delivery_system != SYS_ISDBT;
 
-	if (!retune)
-		return 0;
-	*festat = 0;
-	if (fe->dtv_property_cache.delivery_system == SYS_ISDBT) {
-		t_Hz(&fe->dtv_property_cache.frequency);
-		if (fe->ops.tuner_ops.set_params(fe))
+	int lock_t(void)	/* 1: locked, 0: not yet, -ECANCELED: give up */
+	{
+		if (!tc90522_r(c, 0x80, data, 1) || !tc90522_r(c, 0xB0, data + 1, 1))
 			return -EIO;
-		while (cnt--) {
-			bool	retryov,
-				lock0,
-				lock1;
-			if (!tc90522_r(c, 0x80, data, 1) || !tc90522_r(c, 0xB0, data + 1, 1))
-				break;
-			retryov	= data[0] & 0b10000000 ? true : false;
-			lock0	= data[0] & 0b00001000 ? false : true;
-			lock1	= data[1] & 0b00001000 ? true : false;
-			if (lock0 && lock1) {
-				*festat = FE_HAS_SIGNAL | FE_HAS_CARRIER | FE_HAS_LOCK;
-				*stat = *festat;
-				return 0;
-			}
-			if (retryov)
-				break;
-			msleep_interruptible(1);
+		if (!(data[0] & 0b00001000) && (data[1] & 0b00001000))		/* lock0 && lock1 */
+			return 1;
+		return data[0] & 0b10000000 ? -ECANCELED : 0;				/* retryov: no signal */
+	}
+
+	int lock_s(void)
+	{
+		bool	found	= false;
+		u8	i;
+
+		if (!tc90522_r(c, 0xC3, data, 1))
+			return -EIO;
+		if (data[0] & 0x10)							/* not locked */
+			return 0;
+		if (!t->carrier) {
+			t->carrier	= ktime_get();
+			t->festat	= FE_HAS_SIGNAL | FE_HAS_CARRIER;
 		}
-	} else {	// SYS_ISDBS
-		s_kHz(&fe->dtv_property_cache.frequency);
-		if (fe->ops.tuner_ops.set_params(fe))
+		if (!tc90522_r(c, 0xCE, data, 16))
 			return -EIO;
-		while (cnt--) {
-			u8	i;
-
-			if	((tc90522_r(c, 0xC3, data, 1), !(data[0] & 0x10))	&&	/* locked	*/
-				(tc90522_r(c, 0xCE, data, 2), *(u16 *)data != 0)	&&	/* valid TSID	*/
-				tc90522_r(c, 0xC3, data, 1)				&&
-				tc90522_r(c, 0xCE, data, 16))
-				for (i = 0; i < 8; i++) {
-					u16 tsid = tc90522_n2int(data + i*2, 2);
-
-					if (!tsid || tsid == 0xffff)
-						continue;
-//pr_err("%s Freq %d TSID 0x%04x", __func__, fe->dtv_property_cache.frequency, tsid);
-					if ((set_id == tsid || set_id == i)	&&
-						tc90522_w(c, 0x8F, tsid >> 8)	&&
-						tc90522_w(c, 0x90, tsid & 0xFF)	&&
-						tc90522_r(c, 0xE6, data, 2)	&&
-						tc90522_n2int(data, 2) == tsid) {
-						*festat = FE_HAS_SIGNAL | FE_HAS_CARRIER | FE_HAS_LOCK;
-						*stat = *festat;
-						return 0;
-					}
-				}
-			msleep_interruptible(1);
+		for (i = 0; i < 8; i++) {
+			u16 tsid = tc90522_n2int(data + i*2, 2);
+
+			if (!tsid || tsid == 0xffff)
+				continue;
+			found = true;
+			if ((set_id == tsid || set_id == i)	&&
+				tc90522_w(c, 0x8F, tsid >> 8)	&&
+				tc90522_w(c, 0x90, tsid & 0xFF)	&&
+				tc90522_r(c, 0xE6, data, 2)	&&
+				tc90522_n2int(data, 2) == tsid)
+				return 1;
+		}
+		if (found)								/* wanted TS is not on this carrier */
+			return ++t->miss >= TC90522_TSID_MISS ? -ECANCELED : 0;
+		return ktime_ms_delta(ktime_get(), t->carrier) > TC90522_TSID_MS ? -ECANCELED : 0;	/* empty table */
+	}
+
+	int ret = 0;
+
+	void wait_init(void)
+	{
+		t->festat	= 0;
+		t->miss		= 0;
+		t->carrier	= 0;
+		t->start	= ktime_get();
+		t->timeout	= jiffies + msecs_to_jiffies(TC90522_LOCK_MS);
+	}
+
+	/*
+	 * program the PLL, then return: the lock wait is polled by the frontend thread, every jiffy at first
+	 * then backing off to 1/4 of the time waited so far, so the I2C bus stays free for the other tuners
+	 */
+	if (retune) {
+		u32 locked = t->locked;
+
+		t->wait		= false;
+		t->locked	= 0;
+		if (isdbs)
+			s_kHz(&fe->dtv_property_cache.frequency);
+		else
+			t_Hz(&fe->dtv_property_cache.frequency);
+		wait_init();
+		tc90522_stat_clear(&fe->dtv_property_cache);
+		if (locked == fe->dtv_property_cache.frequency && (ret = isdbs ? lock_s() : lock_t()) > 0)
+			t->fast++;				/* still locked, ISDB-S: only the TSID registers were rewritten */
+		else {
+			ret = 0;
+			wait_init();
+			if (fe->ops.tuner_ops.set_params(fe)) {
+				*stat = t->festat;
+				return -EIO;
+			}
 		}
+		t->wait = true;
 	}
-	*stat = *festat;
-	return -ETIMEDOUT;
+	if (t->wait) {
+		s64 ms;
+
+		if (!ret)
+			ret = isdbs ? lock_s() : lock_t();
+		ms = ktime_ms_delta(ktime_get(), t->start);
+		if (ret > 0) {
+			t->festat	= FE_HAS_SIGNAL | FE_HAS_CARRIER | FE_HAS_LOCK;
+			t->locked	= fe->dtv_property_cache.frequency;
+			if (stat_ms)
+				mod_delayed_work(system_wq, &t->stat, 0);
+		} else if (ret < 0 || time_after(jiffies, t->timeout)) {
+			t->festat = FE_TIMEDOUT;
+			ret = ret < 0 ? ret : -ETIMEDOUT;
+		}
+		t->wait = !ret;
+		if (!t->wait) {
+			dev_dbg(&c->dev, "%u: %s after %lld ms\n", fe->dtv_property_cache.frequency,
+				ret > 0 ? "locked" : ret == -ECANCELED ? "no signal" : "timed out", ms);
+			tc90522_lstat_add(&t->sys[isdbs], ret, ms);
+			tc90522_lstat_add(tc90522_lstat_freq(t, fe->dtv_property_cache.frequency), ret, ms);
+		}
+		*delay = ms < TC90522_FAST_MS ? 1 : msecs_to_jiffies(min_t(s64, ms / 4, TC90522_SLOW_MS));
+	}
+	if (!t->wait)
+		*delay = 3 * HZ;
+	*stat	= t->festat;
+	return ret < 0 ? ret : 0;
+}
+
+static int tc90522_sleep(struct dvb_frontend *fe)
+{
+	struct tc90522 *t = i2c_get_clientdata(fe->demodulator_priv);
+
+	t->locked = 0;					/* tuner is powered down, next tune programs the PLL */
+	cancel_delayed_work_sync(&t->stat);
+	return 0;
 }
 
 static struct dvb_frontend_ops tc90522_ops = {
@@ -223,22 +464,35 @@ static struct dvb_frontend_ops tc90522_ops = {
 		.frequency_max_hz	= 3224000000,	// ISDB-S3 max 3224 MHz
 	},
 	.get_frontend_algo = tc90522_get_frontend_algo,
-	.read_snr	= tc90522_cn_raw,
+	.read_snr	= tc90522_read_snr,
 	.read_status	= tc90522_status,
+	.sleep		= tc90522_sleep,
 	.tune		= tc90522_tune,
 };
 
 static int tc90522_probe(struct i2c_client *c)
 {
 	struct dvb_frontend	*fe	= c->dev.platform_data;
-	static enum fe_status	festat	= 0;
+	struct tc90522		*t	= devm_kzalloc(&c->dev, sizeof(*t), GFP_KERNEL);
 
+	if (!t)
+		return -ENOMEM;
 	memcpy(&fe->ops, &tc90522_ops, sizeof(struct dvb_frontend_ops));
 	fe->demodulator_priv = c;
-	i2c_set_clientdata(c, &festat);
+	i2c_set_clientdata(c, t);
+	t->fe = fe;
+	INIT_DELAYED_WORK(&t->stat, tc90522_stat_work);
+	debugfs_create_file("lock_stats", 0444, c->debugfs, t, &tc90522_lock_stats_fops);
 	return 0;
 }
 
+static void tc90522_remove(struct i2c_client *c)
+{
+	struct tc90522 *t = i2c_get_clientdata(c);
+
+	cancel_delayed_work_sync(&t->stat);
+}
+
 static struct i2c_device_id tc90522_id[] = {
 	{TC90522_MODNAME, 0},
 	{},
@@ -248,6 +502,7 @@ MODULE_DEVICE_TABLE(i2c, tc90522_id);
 static struct i2c_driver tc90522_driver = {
 	.driver.name	= tc90522_id->name,
 	.probe		= tc90522_probe,
+	.remove		= tc90522_remove,
 	.id_table	= tc90522_id,
 };
 module_i2c_driver(tc90522_driver);
@@ -9,6 +9,8 @@
 	GNU General Public License for more details.
 */
 
+#include <linux/hrtimer.h>
+#include <linux/jhash.h>
 #include "ptx_common.h"
 #include "tc90522.h"
 #include "qm1d1c004x.h"
@@ -17,6 +19,7 @@
 MODULE_AUTHOR(PTX_AUTH);
 MODULE_DESCRIPTION("Earthsoft PT3 DVB Driver");
 MODULE_LICENSE("GPL");
+MODULE_SOFTDEP("pre: " TC90522_MODNAME " " QM1D1C004X_MODNAME " " MXL301RF_MODNAME);
 
 static struct pci_device_id pt3_id[] = {
 	{PCI_DEVICE(0x1172, 0x4c15)},
@@ -24,6 +27,22 @@ static struct pci_device_id pt3_id[] = {
 };
 MODULE_DEVICE_TABLE(pci, pt3_id);
 
+static bool drain = true;
+module_param(drain, bool, 0644);
+MODULE_PARM_DESC(drain, "Feed all full DMA blocks per wakeup (default true)");
+
+static bool i2c_cache = true;
+module_param(i2c_cache, bool, 0644);
+MODULE_PARM_DESC(i2c_cache, "Keep write-only I2C programs resident in the FPGA (default true)");
+
+static uint ring_blocks = 17;
+module_param(ring_blocks, uint, 0444);
+MODULE_PARM_DESC(ring_blocks, "DMA ring depth in TS blocks (3-255, default 17)");
+
+static uint block_mul = 1;
+module_param(block_mul, uint, 0444);
+MODULE_PARM_DESC(block_mul, "TS block size in units of 1020 packets (1-8, default 1)");
+
 enum ePT3 {
 	PT3_REG_VERSION	= 0x00,	/*	R	Version		*/
 	PT3_REG_BUS	= 0x04,	/*	R	Bus		*/
@@ -42,16 +61,66 @@ enum ePT3 {
 	PT3_TS_ERR	= 0x14,	/*	R	TS		*/
 
 	PT3_I2C_DATA_OFFSET	= 0x800,
-	PT3_I2C_START_ADDR	= 0x17fa,
+	PT3_I2C_START_ADDR	= 0x17fa,	/* preloaded init program, addresses count nibbles		*/
+	PT3_I2C_PROG_MAX	= 1024,		/* bytes at 0: transient programs & read data, 2048 cmds	*/
+	PT3_I2C_CACHE_ADDR	= 1024,		/* bytes 1024-2047: resident programs, 2048+ is preloaded	*/
+	PT3_I2C_CACHE_SZ	= 1024,
+	PT3_I2C_CACHE_CNT	= 32,
+	PT3_I2C_CMD_NS		= 2500,		/* initial guess of sequencer time per cmd			*/
+	PT3_I2C_CMD_NS_MIN	= 100,
+	PT3_I2C_CMD_NS_MAX	= 20000,
+	PT3_I2C_POLL_US		= 20,		/* poll interval once the estimate has elapsed			*/
+	PT3_I2C_TIMEOUT_MS	= 100,		/* whole flush incl. retries on a dirty bus			*/
+	PT3_I2C_BOOT_TIMEOUT_MS	= 10000,	/* programs of unknown length, e.g. the preloaded init one	*/
+	PT3_HIST_CNT		= 16,		/* log2 usec buckets						*/
 
 	PT3_PWR_OFF		= 0x00,
 	PT3_PWR_AMP_ON		= 0x04,
 	PT3_PWR_TUNER_ON	= 0x40,
+
+	PT3_WAKE_MIN_NS		= 1000000,	/* 1ms				*/
+	PT3_WAKE_MAX_NS		= 100000000,	/* 100ms, ring lasts > 600ms	*/
+	PT3_WAKE_INIT_NS	= 10000000,	/* 10ms until bitrate is known	*/
+
+	PT3_TS_TEST		= 1 << 16,	/* PT3_TS_CTL: test pattern generator, low 16 bits seed	*/
+	PT3_TS_RESET		= 1 << 18,	/* PT3_TS_CTL: back to tuner input, clear PT3_TS_ERR	*/
+	PT3_DMA_TEST_MS		= 1000,
+};
+
+struct pt3_dma_desc {
+	u64 page_addr;
+	u32 page_size;
+	u64 next_desc;
+} __packed;		/* 20B */
+
+enum ePT3_DMA {
+	PT3_DESC_SZ		= sizeof(struct pt3_dma_desc),		/* 20B			*/
+	PT3_DESC_MAX		= 4096 / PT3_DESC_SZ,			/* 204			*/
+	PT3_DESC_PAGE_SZ	= PT3_DESC_MAX * PT3_DESC_SZ,		/* 4080B		*/
+	PT3_TS_PAGE_CNT		= PTX_TS_SIZE / 4,			/* 47 pages = 1020 pkts	*/
+	PT3_TS_BLK_MIN		= 3,
+	PT3_TS_BLK_MAX		= 255,
+	PT3_TS_MUL_MAX		= 8,
 };
 
 struct pt3_card {
 	void __iomem	*bar_reg,
 			*bar_mem;
+	u8	prog[PT3_I2C_PROG_MAX],		/* program being encoded, 2 cmds per byte	*/
+		cache_mem[PT3_I2C_CACHE_SZ],	/* copy of the resident programs		*/
+		cache_cnt;
+	u16	cache_off[PT3_I2C_CACHE_CNT],
+		cache_len[PT3_I2C_CACHE_CNT],
+		cache_used;
+	u32	cache_hash[PT3_I2C_CACHE_CNT];
+	u64	i2c_xfers,
+		i2c_hits,			/* programs run without upload			*/
+		i2c_upload,			/* program bytes written to the FPGA		*/
+		i2c_timeouts,
+		i2c_cmd_ns,			/* calibrated sequencer time per cmd		*/
+		hist_lat[PT3_HIST_CNT],		/* i2c_transfer() entry to completion		*/
+		hist_hold[PT3_HIST_CNT];	/* card->lock hold time				*/
+	bool	dma_high_ok;			/* a ring above 4GB passed pt3_dma_test		*/
 };
 
 struct pt3_dma {
@@ -63,34 +132,94 @@ struct pt3_dma {
 struct pt3_adap {
 	u32	ts_blk_idx,
 		ts_blk_cnt,
+		ts_blk_mul,
 		desc_pg_cnt;
+	u64	blk_ns,		/* observed time to fill 1 TS block	*/
+		empty;		/* wakeups finding no full block	*/
+	ktime_t	stamp,
+		due;		/* next time the worker looks at this ring	*/
 	void __iomem	*dma_base;
 	struct pt3_dma	*ts_info,
 			*desc_info;
 };
 
-static int pt3_i2c_flush(struct pt3_card *c, u32 start_addr)
+static void pt3_hist(u64 *hist, ktime_t start)
 {
-	u32	val	= 0b0110,
-		i	= 999;
+	hist[min_t(u32, fls64(ktime_us_delta(ktime_get(), start)), PT3_HIST_CNT - 1)]++;
+}
+
+/* cmds: program length, 0 if unknown. sleeps for the expected run time instead of spinning */
+static int pt3_i2c_flush(struct pt3_card *c, u32 start_addr, u32 cmds)
+{
+	ktime_t	deadline	= ktime_add_ms(ktime_get(), cmds ? PT3_I2C_TIMEOUT_MS : PT3_I2C_BOOT_TIMEOUT_MS);
+	u32	val		= 0b0110;
 
-	void i2c_wait(void)
+	int i2c_wait(u32 us, bool calib)
 	{
+		u32 polls = 0;
+
 		while (1) {
 			val = readl(c->bar_reg + PT3_REG_I2C_R);
 
 			if (!(val & 1))						/* sequence stopped */
-				return;
-			msleep_interruptible(0);
+				break;
+			if (ktime_after(ktime_get(), deadline))
+				return -ETIMEDOUT;
+			usleep_range(us, us + us / 4 + 1);
+			us = PT3_I2C_POLL_US;
+			polls++;
 		}
+		if (calib && polls == 1)					/* done within the estimate, tighten it */
+			c->i2c_cmd_ns = max_t(u64, c->i2c_cmd_ns - (c->i2c_cmd_ns >> 4), PT3_I2C_CMD_NS_MIN);
+		else if (calib && polls > 1)					/* estimate too short */
+			c->i2c_cmd_ns = min_t(u64, c->i2c_cmd_ns + (c->i2c_cmd_ns >> 3) + 1, PT3_I2C_CMD_NS_MAX);
+		return 0;
 	}
 
-	while ((val & 0b0110) && i--) {						/* I2C bus is dirty */
-		i2c_wait();
+	while (val & 0b0110) {							/* I2C bus is dirty */
+		if (i2c_wait(PT3_I2C_POLL_US, false))
+			goto timeout;
 		writel(1 << 16 | start_addr, c->bar_reg + PT3_REG_I2C_W);	/* 0x00010000 start sequence */
-		i2c_wait();
+		if (i2c_wait(max_t(u32, div_u64((u64)cmds * c->i2c_cmd_ns, 1000), PT3_I2C_POLL_US), cmds))
+			goto timeout;
+		if ((val & 0b0110) && ktime_after(ktime_get(), deadline))
+			break;
 	}
 	return val & 0b0110 ? -EIO : 0;						/* ACK status */
+timeout:
+	c->i2c_timeouts++;
+	return -ETIMEDOUT;
+}
+
+static u32 pt3_i2c_load(struct pt3_card *c, u32 len, bool cacheable)	/* returns start address */
+{
+	u32	hash	= 0,
+		off;
+	u8	i;
+
+	if (cacheable && i2c_cache) {
+		hash = jhash(c->prog, len, 0);
+		for (i = 0; i < c->cache_cnt; i++)
+			if (c->cache_hash[i] == hash && c->cache_len[i] == len && !memcmp(c->cache_mem + c->cache_off[i], c->prog, len)) {
+				c->i2c_hits++;
+				return (PT3_I2C_CACHE_ADDR + c->cache_off[i]) * 2;
+			}
+		if (c->cache_cnt == PT3_I2C_CACHE_CNT || c->cache_used + len > PT3_I2C_CACHE_SZ)
+			c->cache_cnt = c->cache_used = 0;				/* full, start over */
+		off			= c->cache_used;
+		c->cache_off[c->cache_cnt]	= off;
+		c->cache_len[c->cache_cnt]	= len;
+		c->cache_hash[c->cache_cnt]	= hash;
+		c->cache_cnt++;
+		c->cache_used		+= len;
+		memcpy(c->cache_mem + off, c->prog, len);
+		memcpy_toio(c->bar_mem + PT3_I2C_DATA_OFFSET + PT3_I2C_CACHE_ADDR + off, c->prog, len);
+		c->i2c_upload += len;
+		return (PT3_I2C_CACHE_ADDR + off) * 2;
+	}
+	memcpy_toio(c->bar_mem + PT3_I2C_DATA_OFFSET, c->prog, len);
+	c->i2c_upload += len;
+	return 0;
 }
 
 static int pt3_i2c_xfr(struct i2c_adapter *i2c, struct i2c_msg *msg, int sz)
@@ -111,19 +240,21 @@ static int pt3_i2c_xfr(struct i2c_adapter *i2c, struct i2c_msg *msg, int sz)
 	};
 	struct ptx_card *card	= i2c_get_adapdata(i2c);
 	struct pt3_card *c	= card->priv;
-	u32	offset		= 0;
-	u8	buf		= 0;
-	bool	filled		= false;
+	ktime_t	start		= ktime_get(),
+		locked;
+	u32	len		= 0;		/* cmds */
+	int	rd		= 0,
+		ret		= sz;
 
 	void i2c_shoot(u8 dat)
 	{
-		if (filled) {
-			buf |= dat << 4;
-			writeb(buf, c->bar_mem + PT3_I2C_DATA_OFFSET + offset);
-			offset++;
-		} else
-			buf = dat;
-		filled ^= true;
+		if (len < PT3_I2C_PROG_MAX * 2) {
+			if (len & 1)
+				c->prog[len / 2] |= dat << 4;
+			else
+				c->prog[len / 2] = dat;
+		}
+		len++;
 	}
 
 	void i2c_w(const u8 *dat, u32 size)
@@ -150,12 +281,19 @@ static int pt3_i2c_xfr(struct i2c_adapter *i2c, struct i2c_msg *msg, int sz)
 				i2c_shoot(I_DATA_L_NOP);
 		}
 	}
-	int i, j;
+	int i;
 
-	if (sz < 1 || sz > 3 || !msg || msg[0].flags)		/* always write first */
+	if (sz < 1 || !msg || msg[0].flags)		/* always write first */
 		return -ENOTSUPP;
+	for (i = 1; i < sz; i++)
+		if (msg[i].flags & I2C_M_RD) {
+			if (rd)				/* read data always comes back at offset 0 */
+				return -ENOTSUPP;
+			rd = i;
+		}
 	mutex_lock(&card->lock);
-	for (i = 0; i < sz; i++) {
+	locked = ktime_get();
+	for (i = 0; i < sz; i++) {			/* whole transfer is 1 program, repeated start between msgs */
 		u8 byte = (msg[i].addr << 1) | (msg[i].flags & 1);
 
 		/* start */
@@ -164,7 +302,7 @@ static int pt3_i2c_xfr(struct i2c_adapter *i2c, struct i2c_msg *msg, int sz)
 		i2c_shoot(I_DATA_L);
 		i2c_shoot(I_CLOCK_L);
 		i2c_w(&byte, 1);
-		if (msg[i].flags == I2C_M_RD)
+		if (msg[i].flags & I2C_M_RD)
 			i2c_r(msg[i].len);
 		else
 			i2c_w(msg[i].buf, msg[i].len);
@@ -175,18 +313,32 @@ static int pt3_i2c_xfr(struct i2c_adapter *i2c, struct i2c_msg *msg, int sz)
 	i2c_shoot(I_CLOCK_H);
 	i2c_shoot(I_DATA_H);
 	i2c_shoot(I_END);
-	if (filled)
+	if (len & 1)
 		i2c_shoot(I_END);
-	if (pt3_i2c_flush(c, 0))
-		sz = -EIO;
-	else
-		for (i = 1; i < sz; i++)
-			if (msg[i].flags == I2C_M_RD)
-				for (j = 0; j < msg[i].len; j++)
-					msg[i].buf[j] = readb(c->bar_mem + PT3_I2C_DATA_OFFSET + j);
+	if (len > PT3_I2C_PROG_MAX * 2)
+		ret = -ENOTSUPP;
+	else if ((i = pt3_i2c_flush(c, pt3_i2c_load(c, len / 2, !rd), len)))
+		ret = i;
+	else if (rd)
+		memcpy_fromio(msg[rd].buf, c->bar_mem + PT3_I2C_DATA_OFFSET, msg[rd].len);
+	c->i2c_xfers++;
+	pt3_hist(c->hist_hold, locked);
+	pt3_hist(c->hist_lat, start);
 	mutex_unlock(&card->lock);
-	return sz;
+	return ret;
+}
+
+static int pt3_i2c_hist_show(struct seq_file *m, void *v)
+{
+	struct pt3_card	*c	= ((struct ptx_card *)m->private)->priv;
+	u8		i;
+
+	seq_printf(m, "%8s %12s %12s\n", "usec<", "latency", "lock held");
+	for (i = 0; i < PT3_HIST_CNT; i++)
+		seq_printf(m, "%8u %12llu %12llu\n", 1 << i, c->hist_lat[i], c->hist_hold[i]);
+	return 0;
 }
+DEFINE_SHOW_ATTRIBUTE(pt3_i2c_hist);
 
 static const struct i2c_algorithm pt3_i2c_algo = {
 	.functionality	= ptx_i2c_func,
@@ -218,9 +370,14 @@ static int pt3_dma_run(struct ptx_adap *adap, bool ON)
 	int		i	= 999;
 
 	if (ON) {
+		if (!p->ts_info)
+			return -ENOMEM;
 		for (i = 0; i < p->ts_blk_cnt; i++)		/* 17 */
 			*p->ts_info[i].dat	= PTX_TS_NOT_SYNC;
-		p->ts_blk_idx = 0;
+		p->ts_blk_idx	= 0;
+		p->blk_ns	= PT3_WAKE_INIT_NS;
+		p->stamp	= ktime_get();
+		p->due		= ktime_add_ns(p->stamp, PT3_WAKE_INIT_NS);
 		writel(2, base + PT3_DMA_CTL);			/* stop DMA */
 		writeq(p->desc_info->adr, base + PT3_DMA_DESC);
 		writel(1, base + PT3_DMA_CTL);			/* start DMA */
@@ -235,30 +392,282 @@ static int pt3_dma_run(struct ptx_adap *adap, bool ON)
 	return i ? 0 : -ETIMEDOUT;
 }
 
-static int pt3_thread(void *dat)
+static void pt3_pace(struct pt3_adap *p, u32 n)
+{
+	ktime_t	now	= ktime_get();
+	u64	wait;
+
+	if (n) {								/* n blocks since last stamp */
+		u64 ns = div_u64(ktime_to_ns(ktime_sub(now, p->stamp)), n);
+
+		p->blk_ns	= clamp_t(u64, (p->blk_ns * 7 + ns) >> 3, PT3_WAKE_MIN_NS, PT3_WAKE_MAX_NS);
+		p->stamp	= now;
+		wait		= p->blk_ns - (p->blk_ns >> 4);			/* just before the next block fills */
+	} else {
+		wait		= max_t(u64, p->blk_ns >> 3, PT3_WAKE_MIN_NS);
+		p->empty++;
+	}
+	p->due	= ktime_add_ns(now, wait);
+}
+
+static u32 pt3_feed(struct ptx_adap *adap)
 {
-	struct ptx_adap	*adap	= dat;
 	struct pt3_adap	*p	= adap->priv;
-	struct pt3_dma	*ts;
+	u32	idx	= p->ts_blk_idx,
+		prev	= (idx + p->ts_blk_cnt - 1) % p->ts_blk_cnt,
+		cnt	= 0,
+		i;
+
+	if (*p->ts_info[prev].dat == PTX_TS_SYNC) {			/* already read, DMA has lapped us */
+		ptx_stats_add(adap, PTX_STAT_OVERRUNS, 1);
+		*p->ts_info[prev].dat = PTX_TS_NOT_SYNC;
+	}
+	do {								/* count contiguous full blocks */
+		cnt++;
+		idx = (idx + 1) % p->ts_blk_cnt;
+	} while (drain && cnt < p->ts_blk_cnt - 1 && *p->ts_info[(idx + 1) % p->ts_blk_cnt].dat == PTX_TS_SYNC);
+	for (i = 0, idx = p->ts_blk_idx; i < cnt; i++, idx = (idx + 1) % p->ts_blk_cnt)
+		ptx_feed(adap, p->ts_info[idx].dat, p->ts_info[idx].sz / PTX_TS_SIZE);
+	for (i = 0, idx = p->ts_blk_idx; i < cnt; i++, idx = (idx + 1) % p->ts_blk_cnt)
+		*p->ts_info[idx].dat = PTX_TS_NOT_SYNC;		/* mark as read in bulk */
+	ptx_stats_add(adap, PTX_STAT_BLOCKS, cnt);
+	p->ts_blk_idx = idx;
+	return cnt;
+}
+
+static int pt3_thread(void *dat)
+{
+	struct ptx_card	*card	= dat;
 
 	set_freezable();
 	while (!kthread_should_stop()) {
-		u32 next = (p->ts_blk_idx + 1) % p->ts_blk_cnt;
+		ktime_t	now	= ktime_get(),
+			due	= KTIME_MAX;
+		u8	i;
 
 		try_to_freeze();
-		ts = p->ts_info + next;
-		if (*ts->dat != PTX_TS_SYNC) {		/* wait until 1 TS block is full */
-			schedule_timeout_interruptible(0);
-			continue;
+		mutex_lock(&card->wlock);
+		for (i = 0; i < card->adapn; i++) {		/* service every streaming ring that is due */
+			struct ptx_adap	*adap	= &card->adap[i];
+			struct pt3_adap	*p	= adap->priv;
+			u32		n	= 0;
+
+			if (!adap->run)
+				continue;
+			if (!ktime_before(now, p->due)) {
+				while (*p->ts_info[(p->ts_blk_idx + 1) % p->ts_blk_cnt].dat == PTX_TS_SYNC)
+					n += pt3_feed(adap);
+				pt3_pace(p, n);
+				ptx_stats_add(adap, PTX_STAT_WAKEUPS, 1);
+			}
+			due = min(due, p->due);
 		}
-		ts = p->ts_info + p->ts_blk_idx;
-		dvb_dmx_swfilter_packets(&adap->demux, ts->dat, ts->sz / PTX_TS_SIZE);
-		*ts->dat	= PTX_TS_NOT_SYNC;	/* mark as read */
-		p->ts_blk_idx	= next;
+		mutex_unlock(&card->wlock);
+
+		set_current_state(TASK_INTERRUPTIBLE);
+		now = ktime_get();
+		if (due == KTIME_MAX) {
+			for (i = 0; i < card->adapn && !READ_ONCE(card->adap[i].run); i++)
+				;
+			if (i == card->adapn && !kthread_should_stop())	/* idle until ptx_attach() */
+				schedule();
+		} else if (ktime_before(now, due) && !kthread_should_stop())
+			schedule_hrtimeout_range(&due, ktime_to_ns(ktime_sub(due, now)) >> 4, HRTIMER_MODE_ABS);
+		__set_current_state(TASK_RUNNING);
 	}
 	return 0;
 }
 
+static u32 pt3_ts_err(struct ptx_adap *adap)	/* gray coded, cleared by PT3_TS_RESET */
+{
+	u32	gray	= readl(((struct pt3_adap *)adap->priv)->dma_base + PT3_TS_ERR),
+		bin	= gray;
+
+	while (gray >>= 1)
+		bin ^= gray;
+	return bin;
+}
+
+static void pt3_dma_free(struct ptx_adap *adap)
+{
+	struct pt3_adap	*p	= adap->priv;
+	struct device	*dev	= &adap->card->pdev->dev;
+	struct pt3_dma	*page;
+	u32		i;
+
+	if (p->ts_info) {
+		for (i = 0; i < p->ts_blk_cnt; i++) {
+			page = &p->ts_info[i];
+			if (page->dat)
+				dma_free_coherent(dev, page->sz, page->dat, page->adr);
+		}
+		kfree(p->ts_info);
+	}
+	if (p->desc_info) {
+		for (i = 0; i < p->desc_pg_cnt; i++) {
+			page = &p->desc_info[i];
+			if (page->dat)
+				dma_free_coherent(dev, page->sz, page->dat, page->adr);
+		}
+		kfree(p->desc_info);
+	}
+	p->ts_info	= NULL;
+	p->desc_info	= NULL;
+}
+
+static int pt3_dma_create(struct ptx_adap *adap, u32 blk_cnt, u32 blk_mul)
+{
+	struct pt3_adap		*p	= adap->priv;
+	struct device		*dev	= &adap->card->pdev->dev;
+	struct pt3_dma		*descinfo;
+	struct pt3_dma_desc	*prev		= NULL,
+				*curr		= NULL;
+	u32			i,
+				j,
+				pg_cnt		= PT3_TS_PAGE_CNT * blk_mul,
+				desc_todo	= 0,
+				desc_pg_idx	= 0;
+	u64			desc_addr	= 0;
+
+	p->ts_blk_cnt	= blk_cnt;								/* 17	*/
+	p->ts_blk_mul	= blk_mul;
+	p->desc_pg_cnt	= DIV_ROUND_UP(pg_cnt * p->ts_blk_cnt, PT3_DESC_MAX);			/* 4	*/
+	p->ts_info	= kcalloc(p->ts_blk_cnt, sizeof(struct pt3_dma), GFP_KERNEL);
+	p->desc_info	= kcalloc(p->desc_pg_cnt, sizeof(struct pt3_dma), GFP_KERNEL);
+	if (!p->ts_info || !p->desc_info)
+		goto err;
+	for (i = 0; i < p->desc_pg_cnt; i++) {							/* 4	*/
+		p->desc_info[i].sz	= PT3_DESC_PAGE_SZ;					/* 4080B, max 204 * 4 = 816 descs */
+		p->desc_info[i].dat	= dma_alloc_coherent(dev, p->desc_info[i].sz, &p->desc_info[i].adr, GFP_KERNEL);
+		if (!p->desc_info[i].dat)
+			goto err;
+		memset(p->desc_info[i].dat, 0, p->desc_info[i].sz);
+	}
+	for (i = 0; i < p->ts_blk_cnt; i++) {							/* 17	*/
+		p->ts_info[i].sz	= PT3_DESC_PAGE_SZ * pg_cnt;				/* 1020 pkts, 4080 * 47 = 191760B, total 3259920B */
+		p->ts_info[i].dat	= dma_alloc_coherent(dev, p->ts_info[i].sz, &p->ts_info[i].adr, GFP_KERNEL);
+		if (!p->ts_info[i].dat)
+			goto err;
+		for (j = 0; j < pg_cnt; j++) {							/* 47, total 47 * 17 = 799 pages */
+			if (!desc_todo) {							/* 20	*/
+				descinfo	= p->desc_info + desc_pg_idx;			/* jump to next desc_pg */
+				curr		= (struct pt3_dma_desc *)descinfo->dat;
+				desc_addr	= descinfo->adr;
+				desc_todo	= PT3_DESC_MAX;					/* 204	*/
+				desc_pg_idx++;
+			}
+			if (prev)
+				prev->next_desc = desc_addr;
+			curr->page_addr = p->ts_info[i].adr + PT3_DESC_PAGE_SZ * j;
+			curr->page_size = PT3_DESC_PAGE_SZ;
+			curr->next_desc = p->desc_info->adr;					/* circular link */
+			prev		= curr;
+			curr++;
+			desc_addr	+= PT3_DESC_SZ;
+			desc_todo--;
+		}
+	}
+	return 0;
+err:
+	pt3_dma_free(adap);
+	return -ENOMEM;
+}
+
+static bool pt3_dma_high(struct pt3_adap *p)
+{
+	u32 i;
+
+	for (i = 0; i < p->desc_pg_cnt; i++)
+		if (upper_32_bits(p->desc_info[i].adr))
+			return true;
+	for (i = 0; i < p->ts_blk_cnt; i++)
+		if (upper_32_bits(p->ts_info[i].adr))
+			return true;
+	return false;
+}
+
+/* let the test pattern generator fill a ring with pages above 4GB, 0: passed or nothing to test */
+static int pt3_dma_test(struct ptx_adap *adap)
+{
+	struct ptx_card	*card	= adap->card;
+	struct pt3_card	*c	= card->priv;
+	struct pt3_adap	*p	= adap->priv;
+	unsigned long	end;
+	u32		n	= 0;
+
+	if (c->dma_high_ok || !pt3_dma_high(p))
+		return 0;
+	writel(PT3_TS_TEST | (u16)((adap - card->adap + 1) * 12345), p->dma_base + PT3_TS_CTL);
+	pt3_dma_run(adap, true);
+	for (end = jiffies + msecs_to_jiffies(PT3_DMA_TEST_MS); time_before(jiffies, end); usleep_range(1000, 2000)) {
+		for (n = 0; n < p->ts_blk_cnt && READ_ONCE(*p->ts_info[n].dat) == PTX_TS_SYNC; n++)
+			;
+		if (n == p->ts_blk_cnt)
+			break;
+	}
+	pt3_dma_run(adap, false);
+	writel(PT3_TS_RESET, p->dma_base + PT3_TS_CTL);
+	dev_info(&card->pdev->dev, "DMA above 4GB test %s, %u/%u blocks written",
+		n == p->ts_blk_cnt ? "passed" : "failed", n, p->ts_blk_cnt);
+	c->dma_high_ok = n == p->ts_blk_cnt;
+	return c->dma_high_ok ? 0 : -EIO;
+}
+
+static int pt3_dma_resize(struct ptx_adap *adap, u64 blk_cnt, u64 blk_mul)
+{
+	struct pt3_adap	*p	= adap->priv;
+	u32	old_cnt	= p->ts_blk_cnt,
+		old_mul	= p->ts_blk_mul;
+	int	err	= 0;
+
+	if (blk_cnt < PT3_TS_BLK_MIN || blk_cnt > PT3_TS_BLK_MAX || !blk_mul || blk_mul > PT3_TS_MUL_MAX)
+		return -EINVAL;
+	mutex_lock(&adap->demux.mutex);
+	if (adap->feeds)							/* streaming */
+		err = -EBUSY;
+	else if (blk_cnt != old_cnt || blk_mul != old_mul || !p->ts_info) {
+		pt3_dma_free(adap);
+		err = pt3_dma_create(adap, blk_cnt, blk_mul);
+		if (!err && pt3_dma_test(adap)) {				/* first ring above 4GB, and it failed */
+			pt3_dma_free(adap);
+			err = ptx_dma32(adap->card) ?: pt3_dma_create(adap, blk_cnt, blk_mul);
+		}
+		if (err && !pt3_dma_create(adap, old_cnt, old_mul))		/* keep the previous ring */
+			dev_warn(&adap->card->pdev->dev, "%s ring %llux%llu failed, kept %ux%u",
+				adap->dvb.name, blk_cnt, blk_mul, old_cnt, old_mul);
+	}
+	mutex_unlock(&adap->demux.mutex);
+	return err;
+}
+
+static int pt3_ring_depth_get(void *dat, u64 *val)
+{
+	*val = ((struct pt3_adap *)((struct ptx_adap *)dat)->priv)->ts_blk_cnt;
+	return 0;
+}
+
+static int pt3_ring_depth_set(void *dat, u64 val)
+{
+	struct ptx_adap *adap = dat;
+
+	return pt3_dma_resize(adap, val, ((struct pt3_adap *)adap->priv)->ts_blk_mul);
+}
+DEFINE_DEBUGFS_ATTRIBUTE(pt3_ring_depth_fops, pt3_ring_depth_get, pt3_ring_depth_set, "%llu\n");
+
+static int pt3_block_mul_get(void *dat, u64 *val)
+{
+	*val = ((struct pt3_adap *)((struct ptx_adap *)dat)->priv)->ts_blk_mul;
+	return 0;
+}
+
+static int pt3_block_mul_set(void *dat, u64 val)
+{
+	struct ptx_adap *adap = dat;
+
+	return pt3_dma_resize(adap, ((struct pt3_adap *)adap->priv)->ts_blk_cnt, val);
+}
+DEFINE_DEBUGFS_ATTRIBUTE(pt3_block_mul_fops, pt3_block_mul_get, pt3_block_mul_set, "%llu\n");
+
 static void pt3_remove(struct pci_dev *pdev)
 {
 	struct ptx_card	*card	= pci_get_drvdata(pdev);
@@ -270,28 +679,10 @@ static void pt3_remove(struct pci_dev *pdev)
 		return;
 	c	= card->priv;
 	adap	= card->adap;
+	ptx_stop_worker(card);					/* demux/dvr may still be open */
 	for (i = 0; i < card->adapn; i++, adap++) {
-		struct pt3_adap	*p	= adap->priv;
-		struct pt3_dma	*page;
-		u32		j;
-
 		pt3_dma_run(adap, false);
-		if (p->ts_info) {
-			for (j = 0; j < p->ts_blk_cnt; j++) {
-				page = &p->ts_info[j];
-				if (page->dat)
-					dma_free_coherent(&adap->card->pdev->dev, page->sz, page->dat, page->adr);
-			}
-			kfree(p->ts_info);
-		}
-		if (p->desc_info) {
-			for (j = 0; j < p->desc_pg_cnt; j++) {
-				page = &p->desc_info[j];
-				if (page->dat)
-					dma_free_coherent(&adap->card->pdev->dev, page->sz, page->dat, page->adr);
-			}
-			kfree(p->desc_info);
-		}
+		pt3_dma_free(adap);
 		if (adap->fe) {
 			ptx_sleep(adap->fe);
 			pt3_power(adap->fe, PT3_PWR_OFF);
@@ -316,72 +707,32 @@ static int pt3_probe(struct pci_dev *pdev, const struct pci_device_id *ent)
 	};
 	struct ptx_card	*card	= ptx_alloc(pdev, KBUILD_MODNAME, ARRAY_SIZE(pt3_subdev_info),
 					sizeof(struct pt3_card), sizeof(struct pt3_adap), pt3_lnb);
+	u8	i;
+	int	ret	= !card || pci_read_config_byte(pdev, PCI_CLASS_REVISION, &i);
+	ktime_t	t0	= ktime_get();
 
-	bool dma_create(struct pt3_adap	*p)
+	void dbgfs_create(struct ptx_adap *adap)
 	{
-		struct dma_desc {
-			u64 page_addr;
-			u32 page_size;
-			u64 next_desc;
-		} __packed;		/* 20B */
-		enum {
-			DESC_SZ		= sizeof(struct dma_desc),		/* 20B	*/
-			DESC_MAX	= 4096 / DESC_SZ,			/* 204	*/
-			DESC_PAGE_SZ	= DESC_MAX * DESC_SZ,			/* 4080	*/
-			TS_PAGE_CNT	= PTX_TS_SIZE / 4,			/* 47	*/
-			TS_BLOCK_CNT	= 17,
-		};
-		struct pt3_dma	*descinfo;
-		struct dma_desc	*prev		= NULL,
-				*curr		= NULL;
-		u32		i,
-				j,
-				desc_todo	= 0,
-				desc_pg_idx	= 0;
-		u64		desc_addr	= 0;
-
-		p->ts_blk_cnt	= TS_BLOCK_CNT;							/* 17	*/
-		p->desc_pg_cnt	= roundup(TS_PAGE_CNT * p->ts_blk_cnt, DESC_MAX);		/* 4	*/
-		p->ts_info	= kcalloc(p->ts_blk_cnt, sizeof(struct pt3_dma), GFP_KERNEL);
-		p->desc_info	= kcalloc(p->desc_pg_cnt, sizeof(struct pt3_dma), GFP_KERNEL);
-		if (!p->ts_info || !p->desc_info)
-			return false;
-		for (i = 0; i < p->desc_pg_cnt; i++) {						/* 4	*/
-			p->desc_info[i].sz	= DESC_PAGE_SZ;					/* 4080B, max 204 * 4 = 816 descs */
-			p->desc_info[i].dat	= dma_alloc_coherent(&card->pdev->dev, p->desc_info[i].sz, &p->desc_info[i].adr, GFP_KERNEL);
-			if (!p->desc_info[i].dat)
-				return false;
-			memset(p->desc_info[i].dat, 0, p->desc_info[i].sz);
-		}
-		for (i = 0; i < p->ts_blk_cnt; i++) {						/* 17	*/
-			p->ts_info[i].sz	= DESC_PAGE_SZ * TS_PAGE_CNT;			/* 1020 pkts, 4080 * 47 = 191760B, total 3259920B */
-			p->ts_info[i].dat	= dma_alloc_coherent(&card->pdev->dev, p->ts_info[i].sz, &p->ts_info[i].adr, GFP_KERNEL);
-			if (!p->ts_info[i].dat)
-				return false;
-			for (j = 0; j < TS_PAGE_CNT; j++) {					/* 47, total 47 * 17 = 799 pages */
-				if (!desc_todo) {						/* 20	*/
-					descinfo	= p->desc_info + desc_pg_idx;		/* jump to next desc_pg */
-					curr		= (struct dma_desc *)descinfo->dat;
-					desc_addr	= descinfo->adr;
-					desc_todo	= DESC_MAX;				/* 204	*/
-					desc_pg_idx++;
-				}
-				if (prev)
-					prev->next_desc = desc_addr;
-				curr->page_addr = p->ts_info[i].adr + DESC_PAGE_SZ * j;
-				curr->page_size = DESC_PAGE_SZ;
-				curr->next_desc = p->desc_info->adr;				/* circular link */
-				prev		= curr;
-				curr++;
-				desc_addr	+= DESC_SZ;
-				desc_todo--;
-			}
-		}
-		return true;
+		struct pt3_adap	*p	= adap->priv;
+
+		debugfs_create_u64("empty",	0444, adap->dbgfs, &p->empty);
+		debugfs_create_u64("blk_ns",	0444, adap->dbgfs, &p->blk_ns);
+		debugfs_create_file_unsafe("ring_depth",	0644, adap->dbgfs, adap, &pt3_ring_depth_fops);
+		debugfs_create_file_unsafe("block_mul",	0644, adap->dbgfs, adap, &pt3_block_mul_fops);
 	}
 
-	u8	i;
-	int	ret	= !card || pci_read_config_byte(pdev, PCI_CLASS_REVISION, &i);
+	int dma_create(void)
+	{
+		for (i = 0, adap = card->adap; i < card->adapn; i++, adap++) {
+			struct pt3_adap	*p	= adap->priv;
+
+			p->dma_base	= c->bar_reg + PT3_DMA_BASE + PT3_DMA_OFFSET * i;
+			if (pt3_dma_create(adap, clamp_t(u32, ring_blocks, PT3_TS_BLK_MIN, PT3_TS_BLK_MAX),
+						clamp_t(u32, block_mul, 1, PT3_TS_MUL_MAX)))
+				return -ENOMEM;
+		}
+		return 0;
+	}
 
 	if (ret)
 		return ptx_abort(pdev, pt3_remove, ret, "PCI/DMA/memory error");
@@ -396,23 +747,37 @@ static int pt3_probe(struct pci_dev *pdev, const struct pci_device_id *ent)
 	ret = (readl(c->bar_reg + PT3_REG_VERSION) >> 8) & 0xFF00FF;
 	if (ret != 0x030004)
 		return ptx_abort(pdev, pt3_remove, -ENOTSUPP, "PT%d FPGA v%d not supported", ret >> 16, ret & 0xFF);
-	for (i = 0, adap = card->adap; i < card->adapn; i++, adap++) {
-		struct pt3_adap	*p	= adap->priv;
-
-		p->dma_base	= c->bar_reg + PT3_DMA_BASE + PT3_DMA_OFFSET * i;
-		if (!dma_create(p))
-			return ptx_abort(pdev, pt3_remove, -ENOMEM, "Failed dma_create");
+	if (dma_create())
+		return ptx_abort(pdev, pt3_remove, -ENOMEM, "Failed dma_create");
+	for (i = 0; i < card->adapn && !pt3_dma_test(&card->adap[i]) && !c->dma_high_ok; i++)
+		;
+	if (i < card->adapn && !c->dma_high_ok) {			/* failed */
+		for (i = 0; i < card->adapn; i++)
+			pt3_dma_free(&card->adap[i]);
+		if (ptx_dma32(card) || dma_create())
+			return ptx_abort(pdev, pt3_remove, -EIO, "Failed dma_create");
 	}
-	adap--;
+	adap = &card->adap[card->adapn - 1];
+	c->i2c_cmd_ns	= PT3_I2C_CMD_NS;
+	card->ts_err	= pt3_ts_err;
 	ret =	ptx_i2c_add_adapter(card, &pt3_i2c_algo)				||
-		pt3_i2c_flush(c, 0)							||
+		pt3_i2c_flush(c, 0, 0)							||
 		ptx_register_adap(card, pt3_subdev_info, pt3_thread, pt3_dma_run)	||
 		pt3_power(adap->fe, PT3_PWR_TUNER_ON)					||
-		pt3_i2c_flush(c, PT3_I2C_START_ADDR)					||
+		pt3_i2c_flush(c, PT3_I2C_START_ADDR, 0)				||
 		pt3_power(adap->fe, PT3_PWR_TUNER_ON | PT3_PWR_AMP_ON);
-	return	ret ?
-		ptx_abort(pdev, pt3_remove, ret, "Unable to register I2C/DVB adapter/frontend") :
-		0;
+	if (ret)
+		return ptx_abort(pdev, pt3_remove, ret, "Unable to register I2C/DVB adapter/frontend");
+	for (i = 0, adap = card->adap; i < card->adapn; i++, adap++)
+		dbgfs_create(adap);
+	debugfs_create_u64("i2c_xfers",		0444, card->dbgfs, &c->i2c_xfers);
+	debugfs_create_u64("i2c_hits",		0444, card->dbgfs, &c->i2c_hits);
+	debugfs_create_u64("i2c_upload",	0444, card->dbgfs, &c->i2c_upload);
+	debugfs_create_u64("i2c_timeouts",	0444, card->dbgfs, &c->i2c_timeouts);
+	debugfs_create_u64("i2c_cmd_ns",	0444, card->dbgfs, &c->i2c_cmd_ns);
+	debugfs_create_file("i2c_latency",	0444, card->dbgfs, card, &pt3_i2c_hist_fops);
+	dev_info(&pdev->dev, "probed in %lld ms", ktime_ms_delta(ktime_get(), t0));
+	return 0;
 }
 
 static struct pci_driver pt3_driver = {
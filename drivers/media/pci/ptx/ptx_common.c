@@ -10,6 +10,30 @@ MODULE_AUTHOR(PTX_AUTH);
 MODULE_DESCRIPTION("Common DVB registration procedures");
 MODULE_LICENSE("GPL");
 
+static uint feednum = 32;
+module_param(feednum, uint, 0444);
+MODULE_PARM_DESC(feednum, "Max concurrent demux feeds per adapter (1-256, default 32)");
+
+static uint filternum = 32;
+module_param(filternum, uint, 0444);
+MODULE_PARM_DESC(filternum, "Max demux filters per adapter (1-256, default 32)");
+
+static char *worker_cpus;
+module_param(worker_cpus, charp, 0444);
+MODULE_PARM_DESC(worker_cpus, "CPU list the card workers are pinned to, e.g. 2-3 (default any)");
+
+static uint standby_ms;
+module_param(standby_ms, uint, 0444);
+MODULE_PARM_DESC(standby_ms, "Keep tuners powered and tuned this long after the frontend is closed (default 0)");
+
+static bool dma64;
+module_param(dma64, bool, 0444);
+MODULE_PARM_DESC(dma64, "Let PT3 DMA above 4GB, tested when a ring first lands there; a bridge that truncates addresses writes stray RAM during the test (default false), PX-Q3PE stays below");
+
+static int worker_node = NUMA_NO_NODE;
+module_param(worker_node, int, 0444);
+MODULE_PARM_DESC(worker_node, "NUMA node the card workers are pinned to (default any)");
+
 static void ptx_lnb(struct ptx_card *card)
 {
 	struct ptx_adap	*adap;
@@ -27,49 +51,227 @@ static void ptx_lnb(struct ptx_card *card)
 	}
 }
 
-int ptx_sleep(struct dvb_frontend *fe)
+static int ptx_power_off(struct ptx_adap *adap)
 {
-	struct ptx_adap	*adap	= container_of(fe->dvb, struct ptx_adap, dvb);
+	struct dvb_frontend *fe = adap->fe;
 
-	adap->ON = false;
+	adap->idle	= false;
+	adap->warm	= false;
+	adap->ON	= false;
 	ptx_lnb(adap->card);
+	if (adap->tuner_off && adap->tuner_sleep)
+		adap->tuner_sleep(fe);
+	adap->tuner_off	= false;
 	return adap->fe_sleep ? adap->fe_sleep(fe) : 0;
 }
 
+static void ptx_standby(struct work_struct *work)
+{
+	struct ptx_adap *adap = container_of(to_delayed_work(work), struct ptx_adap, standby);
+
+	if (adap->idle)
+		ptx_power_off(adap);
+}
+
+int ptx_sleep(struct dvb_frontend *fe)			/* power down now */
+{
+	struct ptx_adap	*adap	= container_of(fe->dvb, struct ptx_adap, dvb);
+
+	cancel_delayed_work_sync(&adap->standby);
+	return ptx_power_off(adap);
+}
+
 int ptx_wakeup(struct dvb_frontend *fe)
 {
 	struct ptx_adap	*adap	= container_of(fe->dvb, struct ptx_adap, dvb);
 
+	cancel_delayed_work_sync(&adap->standby);
+	if (adap->idle) {				/* still powered and tuned */
+		adap->idle	= false;
+		adap->warm	= true;
+		return 0;
+	}
 	adap->ON = true;
 	ptx_lnb(adap->card);
 	return adap->fe_wakeup ? adap->fe_wakeup(fe) : 0;
 }
 
+static int ptx_fe_sleep(struct dvb_frontend *fe)	/* frontend closed */
+{
+	struct ptx_adap	*adap	= container_of(fe->dvb, struct ptx_adap, dvb);
+	u32		ms	= READ_ONCE(adap->standby_ms);
+
+	if (!ms)
+		return ptx_sleep(fe);
+	adap->idle = true;
+	schedule_delayed_work(&adap->standby, msecs_to_jiffies(ms));
+	return 0;
+}
+
+static int ptx_tuner_sleep(struct dvb_frontend *fe)	/* called by dvb-core right before ptx_fe_sleep */
+{
+	struct ptx_adap	*adap	= container_of(fe->dvb, struct ptx_adap, dvb);
+
+	if (READ_ONCE(adap->standby_ms)) {
+		adap->tuner_off = true;
+		return 0;
+	}
+	return adap->tuner_sleep ? adap->tuner_sleep(fe) : 0;
+}
+
+static int ptx_tuner_wakeup(struct dvb_frontend *fe)	/* called by dvb-core right after ptx_wakeup */
+{
+	struct ptx_adap	*adap	= container_of(fe->dvb, struct ptx_adap, dvb);
+
+	if (adap->warm) {
+		adap->warm	= false;
+		adap->tuner_off	= false;
+		return 0;
+	}
+	adap->tuner_off = false;
+	return adap->tuner_wakeup ? adap->tuner_wakeup(fe) : 0;
+}
+
+void ptx_stats_add(struct ptx_adap *adap, enum ptx_stat i, u64 n)
+{
+	struct ptx_stats	*st	= get_cpu_ptr(adap->stats);
+	unsigned long		flags	= u64_stats_update_begin_irqsave(&st->syncp);
+
+	u64_stats_add(&st->cnt[i], n);
+	u64_stats_update_end_irqrestore(&st->syncp, flags);
+	put_cpu_ptr(adap->stats);
+}
+
+void ptx_feed(struct ptx_adap *adap, const u8 *buf, u32 npkt)	/* count the packets, then demux them */
+{
+	struct ptx_stats	*st;
+	unsigned long		flags;
+	u32			sync	= 0,
+				tei	= 0,
+				i;
+
+	for (i = 0; i < npkt; i++) {
+		sync	+= buf[i * PTX_TS_SIZE] != PTX_TS_SYNC;
+		tei	+= buf[i * PTX_TS_SIZE + 1] >> 7;
+	}
+	st	= get_cpu_ptr(adap->stats);
+	flags	= u64_stats_update_begin_irqsave(&st->syncp);
+	u64_stats_add(&st->cnt[PTX_STAT_PACKETS], npkt);
+	u64_stats_add(&st->cnt[PTX_STAT_SYNC_ERR], sync);
+	u64_stats_add(&st->cnt[PTX_STAT_TEI], tei);
+	u64_stats_update_end_irqrestore(&st->syncp, flags);
+	put_cpu_ptr(adap->stats);
+	dvb_dmx_swfilter_packets(&adap->demux, buf, npkt);
+}
+
+static int ptx_stats_show(struct seq_file *m, void *v)
+{
+	static const char	*name[PTX_STAT_CNT] = {"packets", "blocks", "overruns", "sync_err", "tei", "wakeups"};
+	struct ptx_adap		*adap	= m->private;
+	u64			sum[PTX_STAT_CNT] = {};
+	int			cpu;
+	u8			i;
+
+	for_each_possible_cpu(cpu) {
+		struct ptx_stats	*st	= per_cpu_ptr(adap->stats, cpu);
+		u64			val[PTX_STAT_CNT];
+		unsigned int		start;
+
+		do {
+			start = u64_stats_fetch_begin(&st->syncp);
+			for (i = 0; i < PTX_STAT_CNT; i++)
+				val[i] = u64_stats_read(&st->cnt[i]);
+		} while (u64_stats_fetch_retry(&st->syncp, start));
+		for (i = 0; i < PTX_STAT_CNT; i++)
+			sum[i] += val[i];
+	}
+	seq_printf(m, "%-10s %llu\n", "bytes", sum[PTX_STAT_PACKETS] * PTX_TS_SIZE);
+	for (i = 0; i < PTX_STAT_CNT; i++)
+		seq_printf(m, "%-10s %llu\n", name[i], sum[i]);
+	if (adap->card->ts_err)
+		seq_printf(m, "%-10s %u\n", "ts_err", adap->card->ts_err(adap));
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(ptx_stats);
+
+static void ptx_attach(struct ptx_adap *adap, bool run)
+{
+	struct ptx_card	*card	= adap->card;
+
+	mutex_lock(&card->wlock);			/* worker is between passes */
+	WRITE_ONCE(adap->run, run);
+	mutex_unlock(&card->wlock);
+	if (run && card->kthread)
+		wake_up_process(card->kthread);
+}
+
 static int ptx_stop_feed(struct dvb_demux_feed *feed)
 {
 	struct ptx_adap	*adap	= container_of(feed->demux, struct ptx_adap, demux);
 
+	if (feed->priv != adap)				/* injected through dvr, no DMA */
+		return 0;
+	feed->priv = NULL;
+	if (!adap->feeds || --adap->feeds)		/* serialized by demux->mutex */
+		return 0;
 	adap->card->dma(adap, false);
-	if (adap->kthread)
-		kthread_stop(adap->kthread);
+	ptx_attach(adap, false);
 	return 0;
 }
 
 static int ptx_start_feed(struct dvb_demux_feed *feed)
 {
 	struct ptx_adap	*adap	= container_of(feed->demux, struct ptx_adap, demux);
+	int		err;
+
+	if (adap->demux.dmx.frontend && adap->demux.dmx.frontend->source == DMX_MEMORY_FE)
+		return 0;
+	if (adap->feeds++)				/* already streaming */
+		goto out;
+	err = adap->card->dma(adap, true);
+	if (err) {
+		adap->feeds = 0;
+		return err;
+	}
+	ptx_attach(adap, true);
+out:
+	feed->priv = adap;				/* counted */
+	return 0;
+}
+
+void ptx_stop_worker(struct ptx_card *card)	/* nothing services the rings after this, they may be freed */
+{
+	if (card->kthread)
+		kthread_stop(card->kthread);
+	card->kthread = NULL;
+}
 
-	if (adap->card->thread)
-		adap->kthread = kthread_run(adap->card->thread, adap, "%s_%d%c", adap->dvb.name, adap->dvb.num,
-					adap->fe->dtv_property_cache.delivery_system == SYS_ISDBS ? 's' :
-					adap->fe->dtv_property_cache.delivery_system == SYS_ISDBT ? 't' : 'u');
-	return IS_ERR(adap->kthread) ? PTR_ERR(adap->kthread) : adap->card->dma(adap, true);
+static int ptx_worker(struct ptx_card *card)
+{
+	struct task_struct	*t	= kthread_create_on_node(card->thread, card, dev_to_node(&card->pdev->dev),
+								"%s_%d", card->name, card->adap->dvb.num);
+	cpumask_var_t		mask;
+
+	if (IS_ERR(t))
+		return PTR_ERR(t);
+	if (worker_cpus && *worker_cpus && alloc_cpumask_var(&mask, GFP_KERNEL)) {
+		if (cpulist_parse(worker_cpus, mask) || set_cpus_allowed_ptr(t, mask))
+			dev_warn(&card->pdev->dev, "worker_cpus=%s ignored", worker_cpus);
+		free_cpumask_var(mask);
+	} else if (worker_node != NUMA_NO_NODE) {
+		if (worker_node < 0 || worker_node >= nr_node_ids || set_cpus_allowed_ptr(t, cpumask_of_node(worker_node)))
+			dev_warn(&card->pdev->dev, "worker_node=%d ignored", worker_node);
+	}
+	card->kthread = t;
+	wake_up_process(t);
+	return 0;
 }
 
 struct ptx_card *ptx_alloc(struct pci_dev *pdev, u8 *name, u8 adapn, u32 sz_card_priv, u32 sz_adap_priv,
 			void (*lnb)(struct ptx_card *, bool))
 {
 	u8 i;
+	char dir[32];
 	struct ptx_card *card = kzalloc(sizeof(struct ptx_card) + sz_card_priv
 					+ adapn * (sizeof(struct ptx_adap) + sz_adap_priv), GFP_KERNEL);
 	if (!card)
@@ -81,23 +283,34 @@ struct ptx_card *ptx_alloc(struct pci_dev *pdev, u8 *name, u8 adapn, u32 sz_card
 	card->name	= name;
 	card->lnbON	= true;
 	card->lnb	= lnb;
+	mutex_init(&card->wlock);
 	for (i = 0; i < adapn; i++) {
 		struct ptx_adap *p = &card->adap[i];
 
 		p->card	= card;
 		p->priv	= sz_adap_priv ? (u8 *)&card->adap[adapn] + i * sz_adap_priv : NULL;
 	}
-	if (pci_enable_device(pdev)					||
-		dma_set_mask(&pdev->dev, DMA_BIT_MASK(32))		||
-		dma_set_coherent_mask(&pdev->dev, DMA_BIT_MASK(32))	||
+	if (pci_enable_device(pdev)							||
+		(dma_set_mask_and_coherent(&pdev->dev, DMA_BIT_MASK(dma64 ? 64 : 32))	&&
+		 dma_set_mask_and_coherent(&pdev->dev, DMA_BIT_MASK(32)))		||
 		pci_request_regions(pdev, name)) {
 		kfree(card);
 		return NULL;
 	}
 	pci_set_drvdata(pdev, card);
+	snprintf(dir, sizeof(dir), "%s-%s", name, pci_name(pdev));
+	card->dbgfs = debugfs_create_dir(dir, NULL);
 	return card;
 }
 
+int ptx_dma32(struct ptx_card *card)		/* the probe self-test found DMA above 4GB broken */
+{
+	if (dma_get_mask(&card->pdev->dev) == DMA_BIT_MASK(32))
+		return -EIO;
+	dev_warn(&card->pdev->dev, "DMA above 4GB failed, falling back to 32-bit addresses");
+	return dma_set_mask_and_coherent(&card->pdev->dev, DMA_BIT_MASK(32));
+}
+
 int ptx_i2c_add_adapter(struct ptx_card *card, const struct i2c_algorithm *algo)
 {
 	struct i2c_adapter *i2c = &card->i2c;
@@ -129,7 +342,7 @@ static void ptx_register_subdev(struct i2c_adapter *i2c, struct dvb_frontend *fe
 
 	strscpy(info.type, name, I2C_NAME_SIZE);
 	pr_info("%s %s", __func__, info.type);
-	if (request_module("%s", info.type) < 0) {
+	if (!current_is_async() && request_module("%s", info.type) < 0) {	/* async probe: loaded by MODULE_SOFTDEP */
 		pr_err("%s ERROR request_module %s", __func__, info.type);
 		return;
 	}
@@ -178,8 +391,18 @@ void ptx_unregister_adap(struct ptx_card *card)
 	int		i	= card->adapn - 1;
 	struct ptx_adap	*adap	= card->adap + i;
 
+	debugfs_remove_recursive(card->dbgfs);
+	ptx_stop_worker(card);
 	for (; i >= 0; i--, adap--) {
+		if (adap->fe)
+			cancel_delayed_work_sync(&adap->standby);
 		ptx_unregister_fe(adap->fe);
+		free_percpu(adap->stats);
+		if (adap->demux.dmx.remove_frontend) {
+			adap->demux.dmx.disconnect_frontend(&adap->demux.dmx);
+			adap->demux.dmx.remove_frontend(&adap->demux.dmx, &adap->mem_fe);
+			adap->demux.dmx.remove_frontend(&adap->demux.dmx, &adap->hw_fe);
+		}
 		if (adap->demux.dmx.close)
 			adap->demux.dmx.close(&adap->demux.dmx);
 		if (adap->dmxdev.filter)
@@ -211,27 +434,48 @@ int ptx_register_adap(struct ptx_card *card, const struct ptx_subdev_info *info,
 	card->thread	= thread;
 	card->dma	= dma;
 	for (i = 0, adap = card->adap; i < card->adapn; i++, adap++) {
+		ktime_t			t0	= ktime_get();
 		struct dvb_adapter	*dvb	= &adap->dvb;
 		struct dvb_demux	*demux	= &adap->demux;
 		struct dmxdev		*dmxdev	= &adap->dmxdev;
+		char	dir[16];
 		int	err,
-			num;
+			num,
+			cpu;
 
 		num = dvb_register_adapter(dvb, card->name, THIS_MODULE, &card->pdev->dev, adap_no);
 		if (num < 0) {
 			pr_err("%s DVB_MAX_ADAPTERS=%d, please increase it!", __func__, DVB_MAX_ADAPTERS);
 			return -ENFILE;
 		}
-		demux->dmx.capabilities = DMX_TS_FILTERING | DMX_SECTION_FILTERING;
-		demux->feednum		= 1;
-		demux->filternum	= 1;
+		adap->stats = alloc_percpu(struct ptx_stats);
+		if (!adap->stats)
+			return -ENOMEM;
+		for_each_possible_cpu(cpu)
+			u64_stats_init(&per_cpu_ptr(adap->stats, cpu)->syncp);
+		snprintf(dir, sizeof(dir), "adapter%d", num);
+		adap->dbgfs		= debugfs_create_dir(dir, card->dbgfs);
+		debugfs_create_file("stats", 0444, adap->dbgfs, adap, &ptx_stats_fops);
+		demux->dmx.capabilities = DMX_TS_FILTERING | DMX_SECTION_FILTERING | DMX_MEMORY_BASED_FILTERING;
+		demux->feednum		= clamp_t(uint, feednum, 1, 256);
+		demux->filternum	= clamp_t(uint, filternum, 1, 256);
 		demux->start_feed	= ptx_start_feed;
 		demux->stop_feed	= ptx_stop_feed;
 		if (dvb_dmx_init(demux) < 0)
 			return -ENOMEM;
-		dmxdev->filternum	= 1;
+		dmxdev->filternum	= demux->filternum;
 		dmxdev->demux		= &demux->dmx;
+		dmxdev->may_use_mmap	= true;				/* DMX_REQBUFS, needs CONFIG_DVB_MMAP */
 		err			= dvb_dmxdev_init(dmxdev, dvb);
+		if (err)
+			return err;
+		adap->hw_fe.source	= DMX_FRONTEND_0;
+		adap->mem_fe.source	= DMX_MEMORY_FE;			/* dvr write, e.g. for benchmarks */
+		err			= demux->dmx.add_frontend(&demux->dmx, &adap->hw_fe);
+		if (!err)
+			err		= demux->dmx.add_frontend(&demux->dmx, &adap->mem_fe);
+		if (!err)
+			err		= demux->dmx.connect_frontend(&demux->dmx, &adap->hw_fe);
 		if (err)
 			return err;
 		adap->fe		= ptx_register_fe(&adap->card->i2c, &adap->dvb, &info[i]);
@@ -239,14 +483,22 @@ int ptx_register_adap(struct ptx_card *card, const struct ptx_subdev_info *info,
 			return -ENOMEM;
 		adap->fe_sleep		= adap->fe->ops.sleep;
 		adap->fe_wakeup		= adap->fe->ops.init;
-		adap->fe->ops.sleep	= ptx_sleep;
+		adap->tuner_sleep	= adap->fe->ops.tuner_ops.sleep;
+		adap->tuner_wakeup	= adap->fe->ops.tuner_ops.init;
+		adap->fe->ops.sleep	= ptx_fe_sleep;
 		adap->fe->ops.init	= ptx_wakeup;
-		pr_info("%s %s:%d:%s adapter %d", __func__, card->name, i,
-			adap->fe->dtv_property_cache.delivery_system == SYS_ISDBS ? "ISDBS" :
-			adap->fe->dtv_property_cache.delivery_system == SYS_ISDBT ? "ISDBT" : "UNKNOWN", num);
+		adap->fe->ops.tuner_ops.sleep	= ptx_tuner_sleep;
+		adap->fe->ops.tuner_ops.init	= ptx_tuner_wakeup;
+		adap->standby_ms	= standby_ms;
+		INIT_DELAYED_WORK(&adap->standby, ptx_standby);
+		debugfs_create_u32("standby_ms", 0644, adap->dbgfs, &adap->standby_ms);
 		ptx_sleep(adap->fe);
+		pr_info("%s %s:%d:%s adapter %d, %lld ms", __func__, card->name, i,
+			adap->fe->dtv_property_cache.delivery_system == SYS_ISDBS ? "ISDBS" :
+			adap->fe->dtv_property_cache.delivery_system == SYS_ISDBT ? "ISDBT" : "UNKNOWN", num,
+			ktime_ms_delta(ktime_get(), t0));
 	}
-	return 0;
+	return thread ? ptx_worker(card) : 0;
 }
 
 int ptx_abort(struct pci_dev *pdev, void remover(struct pci_dev *), int err, char *fmt, ...)
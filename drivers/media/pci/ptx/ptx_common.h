@@ -12,9 +12,12 @@
 #ifndef	PTX_COMMON_H
 #define PTX_COMMON_H
 
+#include <linux/async.h>
+#include <linux/debugfs.h>
 #include <linux/freezer.h>
 #include <linux/kthread.h>
 #include <linux/pci.h>
+#include <linux/u64_stats_sync.h>
 #include <media/dvb_demux.h>
 #include <media/dvb_frontend.h>
 #include <media/dmxdev.h>
@@ -27,6 +30,21 @@ enum ePTX {
 	PTX_TS_NOT_SYNC	= 0x74,
 };
 
+enum ptx_stat {
+	PTX_STAT_PACKETS,	/* fed to the demux			*/
+	PTX_STAT_BLOCKS,	/* DMA blocks / buffers processed	*/
+	PTX_STAT_OVERRUNS,	/* data lost to a full ring		*/
+	PTX_STAT_SYNC_ERR,	/* packets without sync byte		*/
+	PTX_STAT_TEI,		/* transport_error_indicator set	*/
+	PTX_STAT_WAKEUPS,	/* worker passes over the adapter	*/
+	PTX_STAT_CNT,
+};
+
+struct ptx_stats {		/* per CPU */
+	u64_stats_t		cnt[PTX_STAT_CNT];
+	struct u64_stats_sync	syncp;
+};
+
 struct ptx_subdev_info {
 	u8	demod_addr,	*demod_name,
 		tuner_addr,	*tuner_name;
@@ -35,9 +53,12 @@ struct ptx_subdev_info {
 
 struct ptx_card {
 	struct ptx_adap		*adap;
-	struct mutex		lock;
+	struct mutex		lock,
+				wlock;		/* held by the worker while servicing adapters */
+	struct task_struct	*kthread;	/* 1 streaming worker per card */
 	struct i2c_adapter	i2c;
 	struct pci_dev		*pdev;
+	struct dentry		*dbgfs;
 	u8	*name,
 		adapn;
 	bool	lnbON;
@@ -45,23 +66,40 @@ struct ptx_card {
 		(*lnb)(struct ptx_card *card, bool lnb);
 	int	(*thread)(void *dat),
 		(*dma)(struct ptx_adap *adap, bool ON);
+	u32	(*ts_err)(struct ptx_adap *adap);	/* optional hardware TS error counter */
 };
 
 struct ptx_adap {
 	struct ptx_card		*card;
-	bool			ON;
+	bool			ON,
+				run,		/* serviced by card->kthread */
+				idle,		/* closed but still powered, see standby */
+				warm,		/* reopened from idle, tuner init not needed */
+				tuner_off;	/* tuner sleep deferred to the standby work */
 	struct dvb_adapter	dvb;
 	struct dvb_demux	demux;
 	struct dmxdev		dmxdev;
+	struct dmx_frontend	hw_fe,
+				mem_fe;
 	struct dvb_frontend	*fe;
-	struct task_struct	*kthread;
+	struct dentry		*dbgfs;
+	struct ptx_stats __percpu	*stats;
+	u32			feeds,		/* running demux feeds */
+				standby_ms;	/* keep the hardware powered this long after close */
+	struct delayed_work	standby;
 	void			*priv;
 	int	(*fe_sleep)(struct dvb_frontend *),
-		(*fe_wakeup)(struct dvb_frontend *);
+		(*fe_wakeup)(struct dvb_frontend *),
+		(*tuner_sleep)(struct dvb_frontend *),
+		(*tuner_wakeup)(struct dvb_frontend *);
 };
 
 struct ptx_card *ptx_alloc(struct pci_dev *pdev, u8 *name, u8 adapn, u32 sz_card_priv, u32 sz_adap_priv,
 			void (*lnb)(struct ptx_card *, bool));
+int ptx_dma32(struct ptx_card *card);
+void ptx_stop_worker(struct ptx_card *card);
+void ptx_stats_add(struct ptx_adap *adap, enum ptx_stat i, u64 n);
+void ptx_feed(struct ptx_adap *adap, const u8 *buf, u32 npkt);
 int ptx_sleep(struct dvb_frontend *fe);
 int ptx_wakeup(struct dvb_frontend *fe);
 int ptx_i2c_add_adapter(struct ptx_card *card, const struct i2c_algorithm *algo);
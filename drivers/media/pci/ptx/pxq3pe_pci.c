@@ -20,6 +20,7 @@
 MODULE_AUTHOR(PTX_AUTH);
 MODULE_DESCRIPTION("PLEX PX-Q3PE Driver");
 MODULE_LICENSE("GPL");
+MODULE_SOFTDEP("pre: " TC90522_MODNAME " " TDA2014X_MODNAME " " NM131_MODNAME);
 
 static u8	crypto_seed[16]	= {0x0B, 0x24, 0x71, 0xE3, 0xC6, 0x1A, 0xF7, 0xCD, 0xC4, 0xF4, 0xF8, 0xA6, 0xF0, 0xB2, 0x01, 0x00};
 
@@ -29,6 +30,10 @@ static struct pci_device_id pxq3pe_id_table[] = {
 };
 MODULE_DEVICE_TABLE(pci, pxq3pe_id_table);
 
+static bool irq_thread = true;
+module_param(irq_thread, bool, 0444);
+MODULE_PARM_DESC(irq_thread, "Demultiplex DMA buffers in a threaded IRQ instead of the hard IRQ (default true)");
+
 enum ePXQ3PE {
 	PKT_NUM		= 312,
 	PKT_BUFSZ	= PTX_TS_SIZE * PKT_NUM,
@@ -60,6 +65,7 @@ enum ePXQ3PE {
 	PXQ3PE_DMA_CTL		= 0xACC,
 
 	PXQ3PE_MAX_LOOP		= 1000,
+	PXQ3PE_HIST_CNT		= 16,	/* log2 usec buckets */
 };
 
 struct pxq3pe_card {
@@ -70,17 +76,23 @@ struct pxq3pe_card {
 		u32		sz;
 		bool		ON[2];
 	} dma;
-	bool	irq_enabled;
+	bool		irq_enabled;
+	wait_queue_head_t	wq;		/* card worker waits for new data		*/
+	unsigned long	pending;		/* half buffers to demux, bit = port * 2 + ch	*/
+	ktime_t		stamp[4];		/* hard IRQ time of each half buffer		*/
+	u64		hist_hard[PXQ3PE_HIST_CNT],	/* time spent in hard IRQ		*/
+			hist_lat[PXQ3PE_HIST_CNT];	/* hard IRQ to stream buffer		*/
 };
 
 struct pxq3pe_adap {
-	u8	tBuf[PKT_BUFSZ],
-		*sBuf;
-	u32	tBufIdx,
+	u8	*sBuf;
+	u32	sBufNew,	/* bytes written past sBufStop, not yet published	*/
 		sBufSize,
-		sBufStart,
-		sBufStop,
-		sBufByteCnt;
+		sBufStart,	/* consumer position, written by pxq3pe_thread only	*/
+		sBufStop,	/* producer position, written by pxq3pe_fanout only	*/
+		sBufDrop;	/* sBufStop when the feed last turned on		*/
+	bool	feed,
+		drop;		/* data up to sBufDrop is stale, set by pxq3pe_dma	*/
 };
 
 static bool pxq3pe_i2c_clean(void __iomem *bar)
@@ -235,18 +247,21 @@ static int pxq3pe_i2c_xfr(struct i2c_adapter *i2c, struct i2c_msg *msg, int sz)
 				: slvadr & 0x80			? PXQ3PE_MOD_STAT
 				: PXQ3PE_MOD_TUNER;
 
-		mutex_lock(&card->lock);
 		if (msg->flags & I2C_M_RD) {
-			u8 *buf	= kzalloc(sz, GFP_KERNEL);
+			u8 *buf	= kzalloc(round_up(msg->len, 4), GFP_KERNEL);	/* FIFO is read in u32 */
 
 			if (!buf)
 				return -ENOMEM;
+			mutex_lock(&card->lock);
 			ret	= pxq3pe_r(card, slvadr, regadr, buf, msg->len, mode);
+			mutex_unlock(&card->lock);
 			memcpy(msg->buf, buf, msg->len);
 			kfree(buf);
-		} else
+		} else {
+			mutex_lock(&card->lock);
 			ret = pxq3pe_w(card, slvadr, regadr, msg->buf, msg->len, mode);
-		mutex_unlock(&card->lock);
+			mutex_unlock(&card->lock);
+		}
 	}
 	return i;
 }
@@ -300,87 +315,168 @@ static void pxq3pe_power(struct ptx_card *card, bool ON)
 	}
 }
 
-static irqreturn_t pxq3pe_irq(int irq, void *ctx)
+static void pxq3pe_hist(u64 *hist, ktime_t start)
+{
+	hist[min_t(u32, fls64(ktime_us_delta(ktime_get(), start)), PXQ3PE_HIST_CNT - 1)]++;
+}
+
+static void pxq3pe_fanout(struct ptx_card *card, u8 buf)
 {
-	struct ptx_card		*card	= ctx;
 	struct pxq3pe_card	*c	= card->priv;
 	void __iomem		*bar	= c->bar;
-	u32	dmamgmt,
-		i,
-		irqstat = readl(bar + PXQ3PE_IRQ_STAT);
-	bool	ch	= irqstat & 0b0101 ? 0 : 1,
-		port	= irqstat & 0b0011 ? 0 : 1;
-	u8	*tbuf	= c->dma.dat + PKT_BUFSZ * (port * 2 + ch);
+	bool	ch	= buf & 1,
+		port	= buf >> 1;
+	u8	*tbuf	= c->dma.dat + PKT_BUFSZ * buf;
+	u32	dmamgmt	= readl(bar + PXQ3PE_DMA_OFFSET_PORT * port + PXQ3PE_DMA_MGMT),
+		i;
 
 	void pxq3pe_dma_put_stream(struct pxq3pe_adap *p)
 	{
-		u8	*src	= p->tBuf;
-		u32	len	= p->tBufIdx,
-			savesz	= len <= p->sBufSize - p->sBufStop ? len : p->sBufSize - p->sBufStop,
-			remain	= len - savesz;
-
-		memcpy(&p->sBuf[p->sBufStop], src, savesz);
-		if (remain)
-			memcpy(p->sBuf, &src[savesz], remain);
-		p->sBufStop = (p->sBufStop + len) % p->sBufSize;
-		if (p->sBufByteCnt == p->sBufSize)
-			p->sBufStart = p->sBufStop;
-		else {
-			if (p->sBufSize >= p->sBufByteCnt + len)
-				p->sBufByteCnt += len;
-			else {
-				p->sBufStart = p->sBufStop;
-				p->sBufByteCnt = p->sBufSize;
-			}
-		}
+		smp_store_release(&p->sBufStop, (p->sBufStop + p->sBufNew) % p->sBufSize);	/* pairs with pxq3pe_thread */
+		p->sBufNew = 0;
 	}
 
-	if (!(irqstat & 0b1111))
-		return IRQ_HANDLED;
-	writel(irqstat, bar + PXQ3PE_IRQ_CLEAR);
-	dmamgmt = readl(bar + PXQ3PE_DMA_OFFSET_PORT * port + PXQ3PE_DMA_MGMT);
-	if ((readl(bar + PXQ3PE_DMA_OFFSET_PORT * port + PXQ3PE_DMA_OFFSET_CH * ch + PXQ3PE_DMA_XFR_STAT) & 0x3FFFFF) == PKT_BUFSZ)
-		for (i = 0; i < PKT_BUFSZ; i += PTX_TS_SIZE) {
+	if ((readl(bar + PXQ3PE_DMA_OFFSET_PORT * port + PXQ3PE_DMA_OFFSET_CH * ch + PXQ3PE_DMA_XFR_STAT) & 0x3FFFFF) == PKT_BUFSZ) {
+		for (i = 0; i < PKT_BUFSZ; i += PTX_TS_SIZE) {		/* copy each packet once, straight into its tuner's ring */
 			u8 idx = !port * 4 + (tbuf[i] == 0xC7 ? 0 : tbuf[i] == 0x47 ?
 					1 : tbuf[i] == 0x07 ? 2 : tbuf[i] == 0x87 ? 3 : card->adapn);
-			struct ptx_adap		*adap	= &card->adap[idx];
-			struct pxq3pe_adap	*p	= adap->priv;
-
-			if (idx < card->adapn && adap->ON) {
-				tbuf[i] = PTX_TS_SYNC;
-				memcpy(&p->tBuf[p->tBufIdx], &tbuf[i], PTX_TS_SIZE);
-				p->tBufIdx += PTX_TS_SIZE;
-				if (p->tBufIdx >= PKT_BUFSZ) {
-					pxq3pe_dma_put_stream(p);
-					p->tBufIdx = 0;
-				}
+			struct pxq3pe_adap	*p;
+			u32			used;
+			u8			*dst;
+
+			if (idx >= card->adapn || !card->adap[idx].ON)
+				continue;
+			p	= card->adap[idx].priv;
+			if (!smp_load_acquire(&p->feed))			/* pairs with pxq3pe_dma */
+				continue;
+			used	= (p->sBufStop + p->sBufSize - smp_load_acquire(&p->sBufStart)) % p->sBufSize + p->sBufNew;
+			if (used + PTX_TS_SIZE >= p->sBufSize) {		/* full, 1 slot kept free */
+				ptx_stats_add(&card->adap[idx], PTX_STAT_OVERRUNS, 1);
+				continue;
 			}
+			dst	= &p->sBuf[(p->sBufStop + p->sBufNew) % p->sBufSize];
+			memcpy(dst, &tbuf[i], PTX_TS_SIZE);
+			*dst	= PTX_TS_SYNC;
+			p->sBufNew += PTX_TS_SIZE;
 		}
+		for (i = !port * 4; i < card->adapn && i < !port * 4 + 4; i++)	/* publish once per half buffer */
+			if (((struct pxq3pe_adap *)card->adap[i].priv)->sBufNew) {
+				pxq3pe_dma_put_stream(card->adap[i].priv);
+				ptx_stats_add(&card->adap[i], PTX_STAT_BLOCKS, 1);
+			}
+		wake_up_interruptible(&c->wq);
+	}
 	if (c->dma.ON[port])
 		writel(dmamgmt | (2 << (ch * 16)), bar + PXQ3PE_DMA_OFFSET_PORT * port + PXQ3PE_DMA_MGMT);
+	pxq3pe_hist(c->hist_lat, c->stamp[buf]);
+}
+
+static irqreturn_t pxq3pe_irq(int irq, void *ctx)
+{
+	struct ptx_card		*card	= ctx;
+	struct pxq3pe_card	*c	= card->priv;
+	ktime_t	now	= ktime_get();
+	u32	irqstat = readl(c->bar + PXQ3PE_IRQ_STAT);
+	u8	i;
+
+	if (!(irqstat & 0b1111))
+		return IRQ_NONE;
+	writel(irqstat, c->bar + PXQ3PE_IRQ_CLEAR);
+	for (i = 0; i < 4; i++) {					/* bit = port * 2 + ch = half buffer */
+		if (!(irqstat & BIT(i)))
+			continue;
+		c->stamp[i] = now;
+		if (irq_thread) {
+			smp_mb__before_atomic();
+			set_bit(i, &c->pending);
+		} else
+			pxq3pe_fanout(card, i);
+	}
+	pxq3pe_hist(c->hist_hard, now);
+	return irq_thread ? IRQ_WAKE_THREAD : IRQ_HANDLED;
+}
+
+static irqreturn_t pxq3pe_irq_thread(int irq, void *ctx)
+{
+	struct ptx_card		*card	= ctx;
+	struct pxq3pe_card	*c	= card->priv;
+
+	while (c->pending) {
+		u8	buf	= __ffs(c->pending),
+			i;
+
+		for (i = buf + 1; i < 4; i++)				/* oldest first, keeps ch0/ch1 in order */
+			if (test_bit(i, &c->pending) && ktime_before(c->stamp[i], c->stamp[buf]))
+				buf = i;
+		clear_bit(buf, &c->pending);
+		pxq3pe_fanout(card, buf);
+	}
 	return IRQ_HANDLED;
 }
 
-static int pxq3pe_thread(void *dat)
+static int pxq3pe_irq_hist_show(struct seq_file *m, void *v)
+{
+	struct pxq3pe_card	*c	= ((struct ptx_card *)m->private)->priv;
+	u8			i;
+
+	seq_printf(m, "%s\n%8s %12s %12s\n", irq_thread ? "threaded" : "hardirq", "usec<", "hardirq", "latency");
+	for (i = 0; i < PXQ3PE_HIST_CNT; i++)
+		seq_printf(m, "%8u %12llu %12llu\n", 1 << i, c->hist_hard[i], c->hist_lat[i]);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(pxq3pe_irq_hist);
+
+static bool pxq3pe_consume(struct ptx_adap *adap)
 {
-	struct ptx_adap		*adap	= dat;
 	struct pxq3pe_adap	*p	= adap->priv;
+	u32			stop;
+
+	if (p->drop) {							/* left by the previous run, under wlock */
+		p->drop = false;
+		smp_store_release(&p->sBufStart, p->sBufDrop);
+	}
+	stop = smp_load_acquire(&p->sBufStop);
+	if (stop == p->sBufStart)
+		return false;
+	if (stop < p->sBufStart)					/* wrapped, feed up to the end first */
+		stop = p->sBufSize;
+	ptx_feed(adap, &p->sBuf[p->sBufStart], (stop - p->sBufStart) / PTX_TS_SIZE);
+	smp_store_release(&p->sBufStart, stop % p->sBufSize);		/* slots may be reused from now */
+	return true;
+}
+
+static int pxq3pe_thread(void *dat)
+{
+	struct ptx_card		*card	= dat;
+	struct pxq3pe_card	*c	= card->priv;
+
+	bool pxq3pe_ready(void)
+	{
+		u8 i;
+
+		for (i = 0; i < card->adapn; i++) {
+			struct pxq3pe_adap *p = card->adap[i].priv;
+
+			if (READ_ONCE(card->adap[i].run) && smp_load_acquire(&p->sBufStop) != p->sBufStart)
+				return true;
+		}
+		return false;
+	}
 
 	set_freezable();
 	while (!kthread_should_stop()) {
-		u8	*rbuf	= &p->sBuf[p->sBufStart];
-		int	sz	= p->sBufSize - p->sBufStart;
+		u8	i;
 
-		try_to_freeze();
-		if (!p->sBufByteCnt) {
-			msleep_interruptible(0);
-			continue;
+		wait_event_freezable(c->wq, pxq3pe_ready() || kthread_should_stop());
+		mutex_lock(&card->wlock);
+		for (i = 0; i < card->adapn; i++) {			/* service every streaming adapter */
+			if (!card->adap[i].run)
+				continue;
+			ptx_stats_add(&card->adap[i], PTX_STAT_WAKEUPS, 1);
+			if (pxq3pe_consume(&card->adap[i]))
+				pxq3pe_consume(&card->adap[i]);	/* rest after a wrap */
 		}
-		if (sz > p->sBufByteCnt)
-			sz = p->sBufByteCnt;
-		dvb_dmx_swfilter(&adap->demux, rbuf, sz);
-		p->sBufStart	= (p->sBufStart + sz) % p->sBufSize;
-		p->sBufByteCnt -= sz;
+		mutex_unlock(&card->wlock);
 	}
 	return 0;
 }
@@ -396,6 +492,11 @@ static int pxq3pe_dma(struct ptx_adap *adap, bool ON)
 	bool			port	= !(idx & 4);
 	u32			val	= 0b0011 << (port * 2);
 
+	if (ON) {							/* not serviced yet, see ptx_attach */
+		p->sBufDrop	= smp_load_acquire(&p->sBufStop);	/* pxq3pe_consume drops up to here */
+		p->drop		= true;
+	}
+	smp_store_release(&p->feed, ON);				/* after sBufDrop, fan-out only appends past it */
 	if (!ON) {
 		for (i = 0; i < card->adapn; i++)
 			if (!c->dma.ON[port] || (idx != i && (i & 4) == (idx & 4) && c->dma.ON[port]))
@@ -409,9 +510,6 @@ static int pxq3pe_dma(struct ptx_adap *adap, bool ON)
 		return 0;
 	}
 
-	p->sBufByteCnt	= 0;
-	p->sBufStop	= 0;
-	p->sBufStart	= 0;
 	if (c->dma.ON[port])
 		return 0;
 
@@ -428,9 +526,10 @@ static int pxq3pe_dma(struct ptx_adap *adap, bool ON)
 	/* cfg_dma */
 	for (i = 0; i < 2; i++) {
 		val		= readl(c->bar + PXQ3PE_DMA_OFFSET_PORT * port + PXQ3PE_DMA_MGMT);
-		writel(c->dma.adr + PKT_BUFSZ * (port * 2 + i),
+		writel(lower_32_bits(c->dma.adr + PKT_BUFSZ * (port * 2 + i)),
 					c->bar + PXQ3PE_DMA_OFFSET_PORT * port + PXQ3PE_DMA_OFFSET_CH * i + PXQ3PE_DMA_ADR_LO);
-		writel(0,		c->bar + PXQ3PE_DMA_OFFSET_PORT * port + PXQ3PE_DMA_OFFSET_CH * i + PXQ3PE_DMA_ADR_HI);
+		writel(upper_32_bits(c->dma.adr + PKT_BUFSZ * (port * 2 + i)),
+					c->bar + PXQ3PE_DMA_OFFSET_PORT * port + PXQ3PE_DMA_OFFSET_CH * i + PXQ3PE_DMA_ADR_HI);
 		writel(0x11C0E520,	c->bar + PXQ3PE_DMA_OFFSET_PORT * port + PXQ3PE_DMA_OFFSET_CH * i + PXQ3PE_DMA_CTL);
 		writel(val | 3 << (i * 16),
 					c->bar + PXQ3PE_DMA_OFFSET_PORT * port + PXQ3PE_DMA_MGMT);
@@ -455,6 +554,7 @@ static void pxq3pe_remove(struct pci_dev *pdev)
 	if (!card)
 		return;
 	c	= card->priv;
+	ptx_stop_worker(card);					/* demux/dvr may still be open */
 	for (i = 0, adap = card->adap; adap->fe && i < card->adapn; i++, adap++) {
 		pxq3pe_dma(adap, false);
 		ptx_sleep(adap->fe);
@@ -462,11 +562,11 @@ static void pxq3pe_remove(struct pci_dev *pdev)
 	pxq3pe_w(card, PXQ3PE_I2C_ADR_GPIO, 0x80, &regctl, 1, PXQ3PE_MOD_GPIO);
 	pxq3pe_power(card, false);
 
+	if (c->irq_enabled)
+		free_irq(pdev->irq, card);
 	/* dma_hw_unmap */
 	if (c->dma.dat)
 		dma_free_attrs(&pdev->dev, c->dma.sz, c->dma.dat, c->dma.adr, 0);
-	if (c->irq_enabled)
-		free_irq(pdev->irq, card);
 
 	for (i = 0; i < card->adapn; i++) {
 		struct ptx_adap		*adap	= &card->adap[i];
@@ -503,6 +603,7 @@ static int pxq3pe_probe(struct pci_dev *pdev, const struct pci_device_id *pci_id
 		i;
 	u16	cfg;
 	int	err	= !card || pci_read_config_word(pdev, PCI_COMMAND, &cfg);
+	ktime_t	t0	= ktime_get();
 
 	if (err)
 		return ptx_abort(pdev, pxq3pe_remove, err, "Memory/PCI error, card=%p", card);
@@ -529,10 +630,18 @@ static int pxq3pe_probe(struct pci_dev *pdev, const struct pci_device_id *pci_id
 	}
 
 	/* IRQ & DMA map */
-	if (request_irq(pdev->irq, pxq3pe_irq, IRQF_SHARED, KBUILD_MODNAME, card))
+	init_waitqueue_head(&c->wq);
+	if (request_threaded_irq(pdev->irq, pxq3pe_irq, irq_thread ? pxq3pe_irq_thread : NULL, IRQF_SHARED, KBUILD_MODNAME, card))
 		return ptx_abort(pdev, pxq3pe_remove, -EIO, "IRQ failed");
 	c->irq_enabled	= true;
+	debugfs_create_file("irq_latency", 0444, card->dbgfs, card, &pxq3pe_irq_hist_fops);
 	c->dma.sz	= PKT_BUFSZ * 4;
+	/*
+	 * no test pattern generator to prove the engine writes above 4GB, and no stream to check at probe:
+	 * stay below 4GB. ADR_HI is still programmed, so this is the only line to drop once a test exists
+	 */
+	if (dma_set_mask_and_coherent(&pdev->dev, DMA_BIT_MASK(32)))
+		return ptx_abort(pdev, pxq3pe_remove, -EIO, "DMA mask failed");
 	c->dma.dat	= dma_alloc_attrs(&pdev->dev, c->dma.sz, &c->dma.adr, GFP_KERNEL, 0);
 	if (!c->dma.dat)
 		return ptx_abort(pdev, pxq3pe_remove, -EIO, "DMA mapping failed");
@@ -565,7 +674,10 @@ static int pxq3pe_probe(struct pci_dev *pdev, const struct pci_device_id *pci_id
 	pxq3pe_power(card, true);
 
 	err = ptx_register_adap(card, pxq3pe_subdev_info, pxq3pe_thread, pxq3pe_dma);
-	return err ? ptx_abort(pdev, pxq3pe_remove, err, "Unable to register DVB adapter & frontend (err=%d)", err) : 0;
+	if (err)
+		return ptx_abort(pdev, pxq3pe_remove, err, "Unable to register DVB adapter & frontend (err=%d)", err);
+	dev_info(&pdev->dev, "probed in %lld ms", ktime_ms_delta(ktime_get(), t0));
+	return 0;
 }
 
 static struct pci_driver pxq3pe_driver = {
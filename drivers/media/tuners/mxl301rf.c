@@ -9,9 +9,28 @@
 	GNU General Public License for more details.
 */
 
+#include <linux/debugfs.h>
 #include <media/dvb_frontend.h>
 #include "mxl301rf.h"
 
+static bool cal_cache = true;
+module_param(cal_cache, bool, 0644);
+MODULE_PARM_DESC(cal_cache, "Replay the RF/spur registers of frequencies tuned before (default true)");
+
+enum mxl301rf_const {
+	MXL301RF_CAL_CNT	= 16,
+};
+
+struct mxl301rf {
+	struct {
+		u32	freq;
+		u8	val[4];		/* 0x61, 0x62: spur shift, 0x11, 0x12: RF */
+	}	cal[MXL301RF_CAL_CNT];
+	u32	ncal;
+	u64	cal_hits,
+		cal_misses;
+};
+
 static int mxl301rf_w(struct dvb_frontend *fe, u8 slvadr, const u8 *dat, int len)
 {
 	struct i2c_client	*d	= fe->demodulator_priv;
@@ -48,14 +67,14 @@ static u8 mxl301rf_r(struct dvb_frontend *fe, u8 regadr)
 {
 	struct i2c_client	*d	= fe->demodulator_priv,
 				*t	= fe->tuner_priv;
-	u8	wbuf[]	= {0xFB, regadr},
+	u8	wbuf[]	= {0xFE, t->addr << 1, 0xFB, regadr},
 		rbuf[]	= {0xFE, (t->addr << 1) | 1, 0};
 	struct i2c_msg msg[] = {
+		{.addr	= d->addr,	.flags	= 0,		.buf	= wbuf,		.len	= 4,},
 		{.addr	= d->addr,	.flags	= 0,		.buf	= rbuf,		.len	= 2,},
 		{.addr	= d->addr,	.flags	= I2C_M_RD,	.buf	= rbuf + 2,	.len	= 1,},
 	};
-	mxl301rf_w_tuner(fe, wbuf, sizeof(wbuf));
-	return t->addr && (i2c_transfer(d->adapter, msg, 2) == 2) ? rbuf[2] : 0;
+	return t->addr && (i2c_transfer(d->adapter, msg, 3) == 3) ? rbuf[2] : 0;
 }
 
 enum mxl301rf_agc {
@@ -65,14 +84,16 @@ enum mxl301rf_agc {
 
 static int mxl301rf_set_agc(struct dvb_frontend *fe, enum mxl301rf_agc agc)
 {
-	u8	dat	= agc == MXL301RF_AGC_AUTO ? 0x40 : 0x00,
-		imsrst	= 0x01 << 6;
-	int	err	= mxl301rf_w(fe, 0x25, &dat, 1);
-
-	dat = 0x4c | (agc == MXL301RF_AGC_AUTO ? 0 : 1);
-	return	err				||
-		mxl301rf_w(fe, 0x23, &dat, 1)	||
-		mxl301rf_w(fe, 0x01, &imsrst, 1);
+	struct i2c_client	*d	= fe->demodulator_priv;
+	bool			on	= agc == MXL301RF_AGC_AUTO;
+	u8			buf[]	= {0x25, on ? 0x40 : 0x00, 0x23, 0x4c | !on, 0x01, 0x01 << 6 /* imsrst */};
+	struct i2c_msg		msg[]	= {
+		{.addr = d->addr,	.flags = 0,	.buf = buf,	.len = 2,},
+		{.addr = d->addr,	.flags = 0,	.buf = buf + 2,	.len = 2,},
+		{.addr = d->addr,	.flags = 0,	.buf = buf + 4,	.len = 2,},
+	};
+
+	return i2c_transfer(d->adapter, msg, ARRAY_SIZE(msg)) == ARRAY_SIZE(msg) ? 0 : -EIO;
 }
 
 static int mxl301rf_sleep(struct dvb_frontend *fe)
@@ -135,8 +156,10 @@ static int mxl301rf_tune(struct dvb_frontend *fe)
 		0x6f, 0x8b,
 		0x70, 0x10+12,
 	};
-	u8	dat[20];
-	int	err	= mxl301rf_set_agc(fe, MXL301RF_AGC_MANUAL);
+	struct mxl301rf	*m	= i2c_get_clientdata(fe->tuner_priv);
+	u8	dat[24];
+	int	err	= mxl301rf_set_agc(fe, MXL301RF_AGC_MANUAL),
+		c	= -1;
 	u32	freq	= fe->dtv_property_cache.frequency,
 		dig_rf	= freq / MHz,
 		tmp	= freq % MHz,
@@ -144,45 +167,90 @@ static int mxl301rf_tune(struct dvb_frontend *fe)
 		fdiv	= 1000000;
 	unsigned long timeout;
 
-	if (err)
-		return err;
-	for (i = 0; i < 6; i++) {
-		dig_rf <<= 1;
-		fdiv /= 2;
-		if (tmp > fdiv) {
-			tmp -= fdiv;
+	void calc(void)
+	{
+		for (i = 0; i < 6; i++) {
+			dig_rf <<= 1;
+			fdiv /= 2;
+			if (tmp > fdiv) {
+				tmp -= fdiv;
+				dig_rf++;
+			}
+		}
+		if (tmp > 7812)
 			dig_rf++;
+		rf_dat[2 * 7 + 1]	= (u8)(dig_rf);
+		rf_dat[2 * 8 + 1]	= (u8)(dig_rf >> 8);
+		for (i = 0; i < ARRAY_SIZE(shf_dvbt_tab); i++) {
+			if ((freq >= (shf_dvbt_tab[i].freq - shf_dvbt_tab[i].freq_th) * kHz) &&
+					(freq <= (shf_dvbt_tab[i].freq + shf_dvbt_tab[i].freq_th) * kHz)) {
+				rf_dat[2 * 5 + 1] = shf_dvbt_tab[i].shf_val;
+				rf_dat[2 * 6 + 1] = 0xa0 | shf_dvbt_tab[i].shf_dir;
+				break;
+			}
 		}
 	}
-	if (tmp > 7812)
-		dig_rf++;
-	rf_dat[2 * 7 + 1]	= (u8)(dig_rf);
-	rf_dat[2 * 8 + 1]	= (u8)(dig_rf >> 8);
-	for (i = 0; i < ARRAY_SIZE(shf_dvbt_tab); i++) {
-		if ((freq >= (shf_dvbt_tab[i].freq - shf_dvbt_tab[i].freq_th) * kHz) &&
-				(freq <= (shf_dvbt_tab[i].freq + shf_dvbt_tab[i].freq_th) * kHz)) {
-			rf_dat[2 * 5 + 1] = shf_dvbt_tab[i].shf_val;
-			rf_dat[2 * 6 + 1] = 0xa0 | shf_dvbt_tab[i].shf_dir;
-			break;
+
+	int run(void)
+	{
+		struct i2c_client	*d	= fe->demodulator_priv;
+		struct i2c_msg		msg[]	= {
+			{.addr = d->addr,	.flags = 0,	.buf = dat,	.len = 4,},
+			{.addr = d->addr,	.flags = 0,	.buf = dat + 4,	.len = 2 + sizeof(idac),},
+		};
+
+		memcpy(dat, rf_dat, sizeof(rf_dat));
+		mxl301rf_w_tuner(fe, dat, 14);
+		msleep_interruptible(1);
+		mxl301rf_w_tuner(fe, dat + 14, 6);
+		msleep_interruptible(1);
+		dat[0] = 0xFE;
+		dat[1] = ((struct i2c_client *)fe->tuner_priv)->addr << 1;
+		dat[2] = 0x1a;
+		dat[3] = 0x0d;
+		memcpy(dat + 4, dat, 2);
+		memcpy(dat + 6, idac, sizeof(idac));
+		i2c_transfer(d->adapter, msg, 2);
+		timeout = jiffies + msecs_to_jiffies(100);
+		while (time_before(jiffies, timeout)) {
+			if ((mxl301rf_r(fe, 0x16) & 0x0f) == 0x0f)		/* RF & REF synthesizers locked */
+				return 0;
+			msleep_interruptible(1);
 		}
+		return -ETIMEDOUT;
 	}
-	memcpy(dat, rf_dat, sizeof(rf_dat));
-
-	mxl301rf_w_tuner(fe, dat, 14);
-	msleep_interruptible(1);
-	mxl301rf_w_tuner(fe, dat + 14, 6);
-	msleep_interruptible(1);
-	dat[0] = 0x1a;
-	dat[1] = 0x0d;
-	mxl301rf_w_tuner(fe, dat, 2);
-	mxl301rf_w_tuner(fe, idac, sizeof(idac));
-	timeout = jiffies + msecs_to_jiffies(100);
-	while (time_before(jiffies, timeout)) {
-		if ((mxl301rf_r(fe, 0x16) & 0x0c) == 0x0c && (mxl301rf_r(fe, 0x16) & 0x03) == 0x03)
-			return mxl301rf_set_agc(fe, MXL301RF_AGC_AUTO);
-		msleep_interruptible(1);
+
+	if (err)
+		return err;
+	for (i = 0; cal_cache && i < min_t(u32, m->ncal, MXL301RF_CAL_CNT); i++)
+		if (m->cal[i].freq == freq)
+			c = i;
+	if (c >= 0) {
+		rf_dat[2 * 5 + 1]	= m->cal[c].val[0];
+		rf_dat[2 * 6 + 1]	= m->cal[c].val[1];
+		rf_dat[2 * 7 + 1]	= m->cal[c].val[2];
+		rf_dat[2 * 8 + 1]	= m->cal[c].val[3];
+		m->cal_hits++;
+		err = run();
+		if (err != -ETIMEDOUT)
+			goto out;
+		m->cal[c].freq = 0;						/* stale, calibrate again */
+		rf_dat[2 * 5 + 1]	= 0x00;					/* defaults for calc() */
+		rf_dat[2 * 6 + 1]	= 0xa0;
 	}
-	return -ETIMEDOUT;
+	m->cal_misses++;
+	calc();
+	err = run();
+	if (!err && cal_cache) {
+		c = m->ncal++ % MXL301RF_CAL_CNT;				/* full: recycle the oldest entry */
+		m->cal[c].freq		= freq;
+		m->cal[c].val[0]	= rf_dat[2 * 5 + 1];
+		m->cal[c].val[1]	= rf_dat[2 * 6 + 1];
+		m->cal[c].val[2]	= rf_dat[2 * 7 + 1];
+		m->cal[c].val[3]	= rf_dat[2 * 8 + 1];
+	}
+out:
+	return err ? err : mxl301rf_set_agc(fe, MXL301RF_AGC_AUTO);
 }
 
 static int mxl301rf_wakeup(struct dvb_frontend *fe)
@@ -200,8 +268,14 @@ static int mxl301rf_wakeup(struct dvb_frontend *fe)
 static int mxl301rf_probe(struct i2c_client *t)
 {
 	struct dvb_frontend	*fe	= t->dev.platform_data;
+	struct mxl301rf		*m	= devm_kzalloc(&t->dev, sizeof(*m), GFP_KERNEL);
 	u8			d[]	= {0x10, 0x01};
 
+	if (!m)
+		return -ENOMEM;
+	i2c_set_clientdata(t, m);
+	debugfs_create_u64("cal_hits",		0444, t->debugfs, &m->cal_hits);
+	debugfs_create_u64("cal_misses",	0444, t->debugfs, &m->cal_misses);
 	fe->tuner_priv			= t;
 	fe->ops.tuner_ops.set_params	= mxl301rf_tune;
 	fe->ops.tuner_ops.sleep		= mxl301rf_sleep;
@@ -7,6 +7,10 @@
 #include <media/dvb_frontend.h>
 #include "nm131.h"
 
+struct nm131 {
+	bool	ready;		/* defaults loaded, deferred from probe to the first open */
+};
+
 static bool nm131_w(struct i2c_client *c, u16 slvadr, u32 val, u32 sz)
 {
 	u8	buf[]	= {0xFE, 0xCE, slvadr >> 8, slvadr & 0xFF, 0, 0, 0, 0};
@@ -177,7 +181,7 @@ static int nm131_tune(struct dvb_frontend *fe)
 		0 : -EIO;
 }
 
-static int nm131_probe(struct i2c_client *c)
+static int nm131_init(struct dvb_frontend *fe)
 {
 	struct tnr_rf_reg_t {
 		u8 slvadr;
@@ -202,11 +206,13 @@ static int nm131_probe(struct i2c_client *c)
 		{356, 2048},	{448, 764156359}
 	};
 	u8			i;
-	struct dvb_frontend	*fe	= c->dev.platform_data;
+	struct i2c_client	*c	= fe->tuner_priv;
+	struct nm131		*n	= i2c_get_clientdata(c);
+	bool			ok;
 
-	fe->tuner_priv			= c;
-	fe->ops.tuner_ops.set_params	= nm131_tune;
-	if (nm131_w8(c, 0xB0, 0xA0)	&&
+	if (n->ready)
+		return 0;
+	ok =	nm131_w8(c, 0xB0, 0xA0)	&&
 		nm131_w8(c, 0xB2, 0x3D)	&&
 		nm131_w8(c, 0xB3, 0x25)	&&
 		nm131_w8(c, 0xB4, 0x8B)	&&
@@ -216,20 +222,35 @@ static int nm131_probe(struct i2c_client *c)
 		nm131_w8(c, 0xB8, 0xC0)	&&
 		nm131_w8(c, 3, 0)	&&
 		nm131_w8(c, 0x1D, 0)	&&
-		nm131_w8(c, 0x1F, 0)) {
-		nm131_w8(c, 0xE, 0x77);
-		nm131_w8(c, 0xF, 0x13);
+		nm131_w8(c, 0x1F, 0)	&&
+		nm131_w8(c, 0xE, 0x77)	&&
+		nm131_w8(c, 0xF, 0x13)	&&
 		nm131_w8(c, 0x75, 2);
-	}
-	for (i = 0; i < ARRAY_SIZE(tnr_rf_defaults_lut); i++)
-		nm131_w(c, tnr_rf_defaults_lut[i].slvadr, tnr_rf_defaults_lut[i].val, 1);
-	nm131_r(c, 0x36, &i, 1);
-	nm131_w(c, 0x36, i & 0x7F, 1);	/* no LDO bypass */
-	nm131_w(c, tnr_bb_defaults_lut[0].slvadr, tnr_bb_defaults_lut[0].val, 4);
-	nm131_w(c, tnr_bb_defaults_lut[1].slvadr, tnr_bb_defaults_lut[1].val, 4);
-	for (i = 0; i < ARRAY_SIZE(nm120_rf_defaults_lut); i++)
-		nm131_w(c, nm120_rf_defaults_lut[i].slvadr, nm120_rf_defaults_lut[i].val, 1);
-	nm131_w(c, 0xA, 0xFB, 1);	/* ltgain */
+	for (i = 0; ok && i < ARRAY_SIZE(tnr_rf_defaults_lut); i++)
+		ok = nm131_w(c, tnr_rf_defaults_lut[i].slvadr, tnr_rf_defaults_lut[i].val, 1);
+	ok =	ok						&&
+		nm131_r(c, 0x36, &i, 1)				&&
+		nm131_w(c, 0x36, i & 0x7F, 1)			&&	/* no LDO bypass */
+		nm131_w(c, tnr_bb_defaults_lut[0].slvadr, tnr_bb_defaults_lut[0].val, 4)	&&
+		nm131_w(c, tnr_bb_defaults_lut[1].slvadr, tnr_bb_defaults_lut[1].val, 4);
+	for (i = 0; ok && i < ARRAY_SIZE(nm120_rf_defaults_lut); i++)
+		ok = nm131_w(c, nm120_rf_defaults_lut[i].slvadr, nm120_rf_defaults_lut[i].val, 1);
+	ok = ok && nm131_w(c, 0xA, 0xFB, 1);	/* ltgain */
+	n->ready = ok;				/* retried at the next open otherwise */
+	return ok ? 0 : -EIO;
+}
+
+static int nm131_probe(struct i2c_client *c)
+{
+	struct dvb_frontend	*fe	= c->dev.platform_data;
+	struct nm131		*n	= devm_kzalloc(&c->dev, sizeof(*n), GFP_KERNEL);
+
+	if (!n)
+		return -ENOMEM;
+	i2c_set_clientdata(c, n);
+	fe->tuner_priv			= c;
+	fe->ops.tuner_ops.set_params	= nm131_tune;
+	fe->ops.tuner_ops.init		= nm131_init;
 	return 0;
 }
 
@@ -14,11 +14,29 @@
 	GNU General Public License for more details.
 */
 
+#include <linux/debugfs.h>
 #include <media/dvb_frontend.h>
 #include "qm1d1c004x.h"
 
+static bool cal_cache = true;
+module_param(cal_cache, bool, 0644);
+MODULE_PARM_DESC(cal_cache, "Replay the PLL/LPF registers of frequencies tuned before (default true)");
+
+enum qm1d1c004x_const {
+	QM1D1C004X_CAL_CNT	= 16,
+};
+
+static const u8 qm1d1c004x_cal_reg[] = {0x02, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x13};	/* set by tune */
+
 struct qm1d1c004x {
-	u8 reg[32];
+	u8	reg[32];
+	struct {
+		u32	freq;
+		u8	val[ARRAY_SIZE(qm1d1c004x_cal_reg)];
+	}	cal[QM1D1C004X_CAL_CNT];
+	u32	ncal;
+	u64	cal_hits,
+		cal_misses;
 };
 
 static bool qm1d1c004x_r(struct dvb_frontend *fe, u8 slvadr, u8 *dat)
@@ -66,6 +84,31 @@ static int qm1d1c004x_w_tuner(struct dvb_frontend *fe, u8 adr, u8 dat)
 	return err;
 }
 
+static int qm1d1c004x_w_tuner_seq(struct dvb_frontend *fe, const u8 *adr_dat, int n)	/* n {adr, dat} pairs, 1 transfer */
+{
+	struct i2c_client	*d	= fe->demodulator_priv,
+				*t	= fe->tuner_priv;
+	struct qm1d1c004x	*q	= i2c_get_clientdata(t);
+	u8			buf[8][4];
+	struct i2c_msg		msg[8];
+	int			i;
+
+	if (n > ARRAY_SIZE(msg))
+		return -EINVAL;
+	for (i = 0; i < n; i++, adr_dat += 2) {
+		buf[i][0]	= 0xFE;
+		buf[i][1]	= t->addr << 1;
+		buf[i][2]	= adr_dat[0];
+		buf[i][3]	= adr_dat[1];
+		msg[i].addr	= d->addr;
+		msg[i].flags	= 0;
+		msg[i].buf	= buf[i];
+		msg[i].len	= 4;
+		q->reg[adr_dat[0]] = adr_dat[1];
+	}
+	return i2c_transfer(d->adapter, msg, n) == n ? 0 : -EIO;
+}
+
 enum qm1d1c004x_agc {
 	QM1D1C004X_AGC_AUTO,
 	QM1D1C004X_AGC_MANUAL,
@@ -73,32 +116,34 @@ enum qm1d1c004x_agc {
 
 static int qm1d1c004x_set_agc(struct dvb_frontend *fe, enum qm1d1c004x_agc agc)
 {
-	u8	dat		= (agc == QM1D1C004X_AGC_AUTO) ? 0xff : 0x00,
-		pskmsrst	= 0x01;
-	int	err		= qm1d1c004x_w(fe, 0x0a, &dat, 1);
+	struct i2c_client	*d	= fe->demodulator_priv;
+	bool			on	= agc == QM1D1C004X_AGC_AUTO;
+	u8			buf[]	= {0x0a, on ? 0xff : 0x00, 0x10, 0xb0 | on, 0x11, on ? 0x40 : 0x00, 0x03, 0x01 /* pskmsrst */};
+	struct i2c_msg		msg[]	= {
+		{.addr = d->addr,	.flags = 0,	.buf = buf,	.len = 2,},
+		{.addr = d->addr,	.flags = 0,	.buf = buf + 2,	.len = 2,},
+		{.addr = d->addr,	.flags = 0,	.buf = buf + 4,	.len = 2,},
+		{.addr = d->addr,	.flags = 0,	.buf = buf + 6,	.len = 2,},
+	};
 
-	if (err)
-		return err;
-	dat = 0xb0 | (agc == QM1D1C004X_AGC_AUTO ? 1 : 0);
-	err = qm1d1c004x_w(fe, 0x10, &dat, 1);
-	if (err)
-		return err;
-	dat = (agc == QM1D1C004X_AGC_AUTO) ? 0x40 : 0x00;
-	return	(err = qm1d1c004x_w(fe, 0x11, &dat, 1)) ?
-		err : qm1d1c004x_w(fe, 0x03, &pskmsrst, 1);
+	return i2c_transfer(d->adapter, msg, ARRAY_SIZE(msg)) == ARRAY_SIZE(msg) ? 0 : -EIO;
 }
 
 static int qm1d1c004x_sleep(struct dvb_frontend *fe)
 {
 	u8	buf	= 1,
-		*reg	= ((struct qm1d1c004x *)fe->tuner_priv)->reg;
+		*reg	= ((struct qm1d1c004x *)i2c_get_clientdata(fe->tuner_priv))->reg,
+		seq[4];
 
 	reg[0x01] &= (~(1 << 3)) & 0xff;
 	reg[0x01] |= 1 << 0;
 	reg[0x05] |= 1 << 3;
+	seq[0] = 0x05;
+	seq[1] = reg[0x05];
+	seq[2] = 0x01;
+	seq[3] = reg[0x01];
 	return	qm1d1c004x_set_agc(fe, QM1D1C004X_AGC_MANUAL)	||
-		qm1d1c004x_w_tuner(fe, 0x05, reg[0x05])		||
-		qm1d1c004x_w_tuner(fe, 0x01, reg[0x01])		||
+		qm1d1c004x_w_tuner_seq(fe, seq, 2)		||
 		qm1d1c004x_w(fe, 0x17, &buf, 1);
 }
 
@@ -118,6 +163,7 @@ static int qm1d1c004x_wakeup(struct dvb_frontend *fe)
 		},
 		*reg	= ((struct qm1d1c004x *)i2c_get_clientdata(fe->tuner_priv))->reg,
 		dat	= 0,
+		seq[4],
 		i;
 
 	for (i = 0; i < ARRAY_SIZE(regs); i++) {
@@ -132,10 +178,13 @@ static int qm1d1c004x_wakeup(struct dvb_frontend *fe)
 	reg[0x01] |= 1 << 3;
 	reg[0x01] &= (~(1 << 0)) & 0xff;
 	reg[0x05] &= (~(1 << 3)) & 0xff;
-	dat = 0;
-	return	qm1d1c004x_w(fe, 0x17, &dat, 1)		||
-		qm1d1c004x_w_tuner(fe, 0x01, reg[0x01])	||
-		qm1d1c004x_w_tuner(fe, 0x05, reg[0x05]);
+	dat	= 0;
+	seq[0]	= 0x01;
+	seq[1]	= reg[0x01];
+	seq[2]	= 0x05;
+	seq[3]	= reg[0x05];
+	return	qm1d1c004x_w(fe, 0x17, &dat, 1)	||
+		qm1d1c004x_w_tuner_seq(fe, seq, 2);
 }
 
 static int qm1d1c004x_tune(struct dvb_frontend *fe)
@@ -145,80 +194,105 @@ static int qm1d1c004x_tune(struct dvb_frontend *fe)
 		{1600000, 1, 4},	{1450000, 1, 3},	{1250000, 1, 2},
 		{1200000, 0, 7},	{ 975000, 0, 6},	{ 950000, 0, 0}
 	};
-	u8	*reg	= ((struct qm1d1c004x *)fe->tuner_priv)->reg;
-	u32	f_kHz	= fe->dtv_property_cache.frequency - 500,
+	struct qm1d1c004x	*q	= i2c_get_clientdata(fe->tuner_priv);
+	u8	*reg	= q->reg;
+	u32	freq	= fe->dtv_property_cache.frequency,
+		f_kHz	= freq - 500,
 		XtalkHz	= 16000,
 		i	= ((f_kHz + XtalkHz / 2) / XtalkHz) * XtalkHz;
 	s64	b	= f_kHz - i;
 	u8	N	= i / (4 * XtalkHz) - 3,
 		A	= (i / XtalkHz) - 4 * (N + 1) - 5;
 	int	sd	= b < 0 ? (0x100000 / XtalkHz) * b + 0x400000 : (0x100000 / XtalkHz) * b,
-		err	= qm1d1c004x_set_agc(fe, QM1D1C004X_AGC_MANUAL);
+		err	= qm1d1c004x_set_agc(fe, QM1D1C004X_AGC_MANUAL),
+		c	= -1;
 
-	if (err)
-		return -EIO;
+	void calc(void)
+	{
+		/* div2/vco_band */
+		for (i = 0; i < 8; i++)
+			if ((fgap_tab[i+1][0] <= f_kHz) && (f_kHz < fgap_tab[i][0]))
+				reg[0x02] = (reg[0x02] & 0x0f) | fgap_tab[i][1] << 7 | fgap_tab[i][2] << 4;
 
-	/* div2/vco_band */
-	for (i = 0; i < 8; i++)
-		if ((fgap_tab[i+1][0] <= f_kHz) && (f_kHz < fgap_tab[i][0]))
-			qm1d1c004x_w_tuner(fe, 0x02, (reg[0x02] & 0x0f) | fgap_tab[i][1] << 7 | fgap_tab[i][2] << 4);
-
-	reg[0x06] &= 0x40;
-	reg[0x06] |= N;
-	reg[0x07] &= 0xf0;
-	reg[0x07] |= A & 0x0f;
-
-	/* LPF */
-	reg[0x08] &= 0xf0;
-	reg[0x08] |= 0x09;
-	reg[0x13] &= 0x9f;
-	reg[0x13] |= 0x20;
-	err =	qm1d1c004x_w_tuner(fe, 0x06, reg[0x06])	||
-		qm1d1c004x_w_tuner(fe, 0x07, reg[0x07])	||
-		qm1d1c004x_w_tuner(fe, 0x08, (reg[0x08] & 0xf0) | 2);
-	if (err)
-		return err;
-	reg[0x09] &= 0xc0;
-	reg[0x09] |= (sd >> 16) & 0x3f;
-	reg[0x0a] = (sd >> 8) & 0xff;
-	reg[0x0b] = (sd >> 0) & 0xff;
-	err =	qm1d1c004x_w_tuner(fe, 0x09, reg[0x09])	||
-		qm1d1c004x_w_tuner(fe, 0x0a, reg[0x0a])	||
-		qm1d1c004x_w_tuner(fe, 0x0b, reg[0x0b])	||
-		qm1d1c004x_w_tuner(fe, 0x0c, reg[0x0c] & 0x3f);
-	if (err)
-		return err;
-	msleep_interruptible(1);
-	err =	qm1d1c004x_w_tuner(fe, 0x0c, reg[0x0c] | 0xc0)	||
-		qm1d1c004x_w_tuner(fe, 0x08, 0x09)		||
-		qm1d1c004x_w_tuner(fe, 0x13, reg[0x13]);
-	if (err)
-		return err;
-	for (i = 0; i < 500; i++) {
-		if (!qm1d1c004x_r(fe, 0x0d, &reg[0x0d]))
-			return -EIO;
-		if (reg[0x0d] & 0x40)	/* locked */
-			return qm1d1c004x_set_agc(fe, QM1D1C004X_AGC_AUTO);
+		reg[0x06] &= 0x40;
+		reg[0x06] |= N;
+		reg[0x07] &= 0xf0;
+		reg[0x07] |= A & 0x0f;
+
+		/* LPF */
+		reg[0x08] &= 0xf0;
+		reg[0x08] |= 0x09;
+		reg[0x13] &= 0x9f;
+		reg[0x13] |= 0x20;
+		reg[0x09] &= 0xc0;
+		reg[0x09] |= (sd >> 16) & 0x3f;
+		reg[0x0a] = (sd >> 8) & 0xff;
+		reg[0x0b] = (sd >> 0) & 0xff;
+	}
+
+	int run(void)		/* same registers give the same I2C program, cheap to resend */
+	{
+		u8	pll[]	= {
+				0x02, reg[0x02],	0x06, reg[0x06],	0x07, reg[0x07],	0x08, (reg[0x08] & 0xf0) | 2,
+				0x09, reg[0x09],	0x0a, reg[0x0a],	0x0b, reg[0x0b],	0x0c, reg[0x0c] & 0x3f,
+			},
+			start[]	= {0x0c, reg[0x0c] | 0xc0,	0x08, 0x09,	0x13, reg[0x13]};
+		int	ret	= qm1d1c004x_w_tuner_seq(fe, pll, ARRAY_SIZE(pll) / 2);
+
+		if (ret)
+			return ret;
 		msleep_interruptible(1);
+		ret = qm1d1c004x_w_tuner_seq(fe, start, ARRAY_SIZE(start) / 2);
+		if (ret)
+			return ret;
+		for (i = 0; i < 500; i++) {
+			if (!qm1d1c004x_r(fe, 0x0d, &reg[0x0d]))
+				return -EIO;
+			if (reg[0x0d] & 0x40)	/* locked */
+				return 0;
+			msleep_interruptible(1);
+		}
+		return -ETIMEDOUT;
 	}
-	return -ETIMEDOUT;
-}
 
-static void qm1d1c004x_remove(struct i2c_client *t)
-{
-	kfree(i2c_get_clientdata(t));
-	return;
+	if (err)
+		return -EIO;
+	for (i = 0; cal_cache && i < min_t(u32, q->ncal, QM1D1C004X_CAL_CNT); i++)
+		if (q->cal[i].freq == freq)
+			c = i;
+	if (c >= 0) {
+		for (i = 0; i < ARRAY_SIZE(qm1d1c004x_cal_reg); i++)
+			reg[qm1d1c004x_cal_reg[i]] = q->cal[c].val[i];
+		q->cal_hits++;
+		err = run();
+		if (err != -ETIMEDOUT)
+			goto out;
+		q->cal[c].freq = 0;						/* stale, calibrate again */
+	}
+	q->cal_misses++;
+	calc();
+	err = run();
+	if (!err && cal_cache) {
+		c = q->ncal++ % QM1D1C004X_CAL_CNT;				/* full: recycle the oldest entry */
+		q->cal[c].freq = freq;
+		for (i = 0; i < ARRAY_SIZE(qm1d1c004x_cal_reg); i++)
+			q->cal[c].val[i] = reg[qm1d1c004x_cal_reg[i]];
+	}
+out:
+	return err ? err : qm1d1c004x_set_agc(fe, QM1D1C004X_AGC_AUTO);
 }
 
 static int qm1d1c004x_probe(struct i2c_client *t)
 {
 	struct dvb_frontend	*fe	= t->dev.platform_data;
-	struct qm1d1c004x	*q	= kzalloc(sizeof(struct qm1d1c004x), GFP_KERNEL);
+	struct qm1d1c004x	*q	= devm_kzalloc(&t->dev, sizeof(struct qm1d1c004x), GFP_KERNEL);	/* outlives the debugfs files */
 	u8			d[]	= {0x10, 0x15, 0x04};
 
 	if (!q)
 		return -ENOMEM;
 	i2c_set_clientdata(t, q);
+	debugfs_create_u64("cal_hits",		0444, t->debugfs, &q->cal_hits);
+	debugfs_create_u64("cal_misses",	0444, t->debugfs, &q->cal_misses);
 	fe->tuner_priv			= t;
 	fe->ops.tuner_ops.set_params	= qm1d1c004x_tune;
 	fe->ops.tuner_ops.sleep		= qm1d1c004x_sleep;
@@ -237,7 +311,6 @@ MODULE_DEVICE_TABLE(i2c, qm1d1c004x_id);
 static struct i2c_driver qm1d1c004x_driver = {
 	.driver.name	= qm1d1c004x_id->name,
 	.probe		= qm1d1c004x_probe,
-	.remove		= qm1d1c004x_remove,
 	.id_table	= qm1d1c004x_id,
 };
 module_i2c_driver(qm1d1c004x_driver);
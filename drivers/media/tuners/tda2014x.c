@@ -4,9 +4,31 @@
 	Copyright (C) Budi Rachmanto, AreMa Inc. <info@are.ma>
 */
 
+#include <linux/debugfs.h>
 #include <media/dvb_frontend.h>
 #include "tda2014x.h"
 
+static bool cal_cache = true;
+module_param(cal_cache, bool, 0644);
+MODULE_PARM_DESC(cal_cache, "Replay the LO/PLL divider registers of frequencies tuned before (default true)");
+
+enum tda2014x_const {
+	TDA2014X_CAL_CNT	= 16,
+};
+
+static const u8 tda2014x_cal_reg[] = {0x22, 0x23, 0x25, 0x03, 0x1A, 0x1E, 0x1F, 0x20};	/* LO config & PLL divider */
+
+struct tda2014x {
+	struct {
+		u32	freq;
+		u8	val[ARRAY_SIZE(tda2014x_cal_reg)];
+	}	cal[TDA2014X_CAL_CNT];
+	u32	ncal;
+	bool	ready;		/* POR done, deferred from probe to the first open */
+	u64	cal_hits,
+		cal_misses;
+};
+
 static int tda2014x_r(struct i2c_client *c, u8 slvadr)
 {
 	u8	buf[]	= {0xFE, 0xA8, slvadr},
@@ -66,6 +88,25 @@ static bool tda2014x_w16(struct i2c_client *c, u16 slvadr, u8 start_bit, u8 nbit
 	return true;
 }
 
+static bool tda2014x_cal_replay(struct i2c_client *c, const u8 *val)	/* plain writes, no read-modify-write */
+{
+	u8		buf[ARRAY_SIZE(tda2014x_cal_reg)][4];
+	struct i2c_msg	msg[ARRAY_SIZE(tda2014x_cal_reg)];
+	int		i;
+
+	for (i = 0; i < ARRAY_SIZE(msg); i++) {
+		buf[i][0]	= 0xFE;
+		buf[i][1]	= 0xA8;
+		buf[i][2]	= tda2014x_cal_reg[i];
+		buf[i][3]	= val[i];
+		msg[i].addr	= c->addr;
+		msg[i].flags	= 0;
+		msg[i].buf	= buf[i];
+		msg[i].len	= 4;
+	}
+	return i2c_transfer(c->adapter, msg, ARRAY_SIZE(msg)) == ARRAY_SIZE(msg);
+}
+
 static int tda2014x_tune(struct dvb_frontend *fe)
 {
 	u64 div10(u64 n, u8 pow)
@@ -132,6 +173,20 @@ static int tda2014x_tune(struct dvb_frontend *fe)
 		gain	= (lna == TDA2014X_LNA_GAIN_18dB) | ((lna & 3) << 4) | (TDA2014X_LPT_GAIN_NEGATIVE_10dB << 1),
 		ampout	= TDA2014X_AMPOUT_21DB;
 	struct i2c_client	*c	= fe->tuner_priv;
+	struct tda2014x		*t	= i2c_get_clientdata(c);
+	int			cal	= -1,
+				err,
+				k;
+
+	for (k = 0; cal_cache && k < min_t(u32, t->ncal, TDA2014X_CAL_CNT); k++)
+		if (t->cal[k].freq == f_kHz)
+			cal = k;
+	if (cal >= 0) {
+		t->cal_hits++;
+		goto program;
+	}
+full:
+	t->cal_misses++;
 
 	/* GetLoConfig */
 	if (!tda2014x_r8(c, 0x25, 3, 1, &val))
@@ -207,17 +262,19 @@ LABEL_36:
 			CalcPow--;
 		}
 	}
-	return	!(tda2014x_w8(c, 0xA, 0)	&&
+program:
+	err =	!(tda2014x_w8(c, 0xA, 0)	&&
 		tda2014x_w8(c, 0x10, 0xB0)	&&
 		tda2014x_w8(c, 0x11, 2)	&&
 		tda2014x_w8(c, 3, 1)		&&
 
+		(cal >= 0 ? tda2014x_cal_replay(c, t->cal[cal].val) :
 		tda2014x_w16(c, 3, 6, 2, 0, 1, 6, ePllRefClkRatio)	&&
 
 		/* SetPllDividerConfig */
 		tda2014x_w16(c, 0x1A, 5, 1, 0, 1, 6, PredividerRatio)			&&
 		tda2014x_w16(c, 0x1E, 0, 8, 0, 0, 6, DsmIntInReg - 128)		&&
-		tda2014x_w16(c, 0x1F, 0, 0x10, 2, 0, 6, div10(DsmFracInReg, CalcPow))	&&
+		tda2014x_w16(c, 0x1F, 0, 0x10, 2, 0, 6, div10(DsmFracInReg, CalcPow)))	&&
 
 		/* ProgramVcoChannelChange */
 		tda2014x_r8(c, 0x12, 0, 8, &val)				&&
@@ -250,17 +307,37 @@ LABEL_36:
 		tda2014x_w8(c, 0x10, 0xB2)	&&
 		tda2014x_w8(c, 0x11, 0)	&&
 		tda2014x_w8(c, 3, 1)) * -EIO;
+	if (err && cal >= 0) {				/* stale, calibrate again */
+		t->cal[cal].freq = 0;
+		cal = -1;
+		goto full;
+	}
+	if (!err && cal < 0 && cal_cache) {
+		u8 v[ARRAY_SIZE(tda2014x_cal_reg)];
+
+		for (k = 0; k < ARRAY_SIZE(v) && tda2014x_r8(c, tda2014x_cal_reg[k], 0, 8, v + k); k++)
+			;
+		if (k == ARRAY_SIZE(v)) {
+			cal = t->ncal++ % TDA2014X_CAL_CNT;	/* full: recycle the oldest entry */
+			t->cal[cal].freq = f_kHz;
+			memcpy(t->cal[cal].val, v, sizeof(v));
+		}
+	}
+	return err;
 }
 
-static int tda2014x_probe(struct i2c_client *c)
+static int tda2014x_init(struct dvb_frontend *fe)
 {
 	u8			val	= 0;
-	struct dvb_frontend	*fe	= c->dev.platform_data;
+	struct i2c_client	*c	= fe->tuner_priv;
+	struct tda2014x		*t	= i2c_get_clientdata(c);
+	u32			freq	= fe->dtv_property_cache.frequency;
+	int			err;
 
-	fe->tuner_priv			= c;
-	fe->ops.tuner_ops.set_params	= tda2014x_tune;
+	if (t->ready)
+		return 0;
 	fe->dtv_property_cache.frequency = 1318000;
-	return	!(tda2014x_w8(c, 0x13, 0)	&&
+	err =	!(tda2014x_w8(c, 0x13, 0)	&&
 		tda2014x_w8(c, 0x15, 0)	&&
 		tda2014x_w8(c, 0x17, 0)	&&
 		tda2014x_w8(c, 0x1C, 0)	&&
@@ -345,6 +422,25 @@ static int tda2014x_probe(struct i2c_client *c)
 		tda2014x_w16(c, 6, 0, 8, 0, 0, 6, (val & 0xF7) | 8)) ? -EIO	:
 
 		tda2014x_tune(fe);
+	fe->dtv_property_cache.frequency = freq;
+	t->ready = !err;
+	return err;
+}
+
+static int tda2014x_probe(struct i2c_client *c)
+{
+	struct dvb_frontend	*fe	= c->dev.platform_data;
+	struct tda2014x		*t	= devm_kzalloc(&c->dev, sizeof(*t), GFP_KERNEL);
+
+	if (!t)
+		return -ENOMEM;
+	i2c_set_clientdata(c, t);
+	debugfs_create_u64("cal_hits",		0444, c->debugfs, &t->cal_hits);
+	debugfs_create_u64("cal_misses",	0444, c->debugfs, &t->cal_misses);
+	fe->tuner_priv			= c;
+	fe->ops.tuner_ops.set_params	= tda2014x_tune;
+	fe->ops.tuner_ops.init		= tda2014x_init;
+	return 0;
 }
 
 static struct i2c_device_id tda2014x_id[] = {
@@ -65,6 +65,15 @@ typedef struct pm_message {
 #include <linux/fs.h>
 #include <linux/cdev.h>
 #include <linux/ioctl.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/workqueue.h>
+#include <linux/mm.h>
+#include <linux/uio.h>
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,16,0)
+typedef unsigned int __poll_t;
+#endif
 
 // pt3_com.h ///////////////////////////////////////////////////////
 
@@ -234,6 +243,40 @@ typedef	struct	_frequency{
 #define		SET_TEST_MODE_OFF _IO(0x8d, 0x09)
 #define		GET_TS_ERROR_PACKET_COUNT _IOR(0x8d, 0x0a, unsigned int *)
 
+// mmap() of the TS ring: block n lives at offset n * size, filled blocks
+// are tail .. head - 1 (mod count), RELEASE_BLOCKS moves tail on.  Filled
+// blocks hold the TS as the DMA wrote it; a block that falls behind more
+// than count - 4 blocks is dropped and RELEASE_BLOCKS then fails.
+typedef struct _pt3_ring {
+	unsigned int count;
+	unsigned int size;
+	unsigned int head;
+	unsigned int tail;
+} PT3_RING;
+
+#define		GET_RING	_IOR(0x8d, 0x0b, PT3_RING)
+#define		RELEASE_BLOCKS	_IOW(0x8d, 0x0c, int)
+
+// SET_CHANNEL_ASYNC returns at once, the end of the tune raises POLLPRI on
+// every open file of the channel, GET_TUNE_STATUS tells the result and
+// clears the event for the file it is called on.
+enum {
+	PT3_TUNE_IDLE,
+	PT3_TUNE_BUSY,
+	PT3_TUNE_LOCKED,
+	PT3_TUNE_FAILED,
+};
+
+typedef struct _pt3_tune_status {
+	int state;
+	int status;		// SET_CHANNEL error, 0 when locked
+	unsigned int elapsed;	// ms from SET_CHANNEL_ASYNC to lock / failure, or so far
+} PT3_TUNE_STATUS;
+
+#define		SET_CHANNEL_ASYNC	_IOW(0x8d, 0x0d, FREQUENCY)
+#define		GET_TUNE_STATUS	_IOR(0x8d, 0x0e, PT3_TUNE_STATUS)
+#define		GET_OVERRUNS	_IOR(0x8d, 0x0f, unsigned int)	// blocks this open file lost
+
 // pt3_pci.h ///////////////////////////////////////////////////////
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,37)
@@ -354,10 +397,31 @@ typedef struct __PT3_DMA {
 	PT3_DMA_PAGE *desc_info;
 	u32 ts_count;
 	PT3_DMA_PAGE *ts_info;
-	u32 ts_pos;
-	struct mutex lock;
+	int look_ready;			// 0 in test mode, read without waiting for the DMA
+	spinlock_t track;		// head, produced, gen and the reader cursors
+	u32 head;			// block the DMA is writing
+	u64 produced;			// blocks completed so far
+	u32 gen;			// bumped on every DMA reset
+	wait_queue_head_t wait;		// readers waiting for a filled page
+	struct delayed_work watch;	// no DMA interrupt, so poll for filled pages
 } PT3_DMA;
 
+// one per open file, several may share a channel
+typedef struct _PT3_READER {
+	struct _PT3_CHANNEL *channel;
+	struct mutex lock;		// read, GET_RING / RELEASE_BLOCKS
+	int started;			// START_REC done
+	u32 gen;
+	u64 seq;			// next block to read
+	u32 pos;			// its index in ts_info
+	u32 data_pos;
+	u32 overruns;			// blocks lost to the DMA
+	u32 tune_seen;			// channel tune_seq at the last GET_TUNE_STATUS, under channel->lock
+} PT3_READER;
+
+#define		DMA_WATCH_MS		10
+#define		DMA_WAIT_MS		600
+
 // pt3_bus.c ///////////////////////////////////////////////////////
 
 enum {
@@ -2396,6 +2460,7 @@ free_pt3_mx(PT3_MX *mx)
 #endif
 #define DMA_TS_BUF_SIZE		(PAGE_BLOCK_SIZE * PAGE_BLOCK_COUNT)
 #define NOT_SYNC_BYTE		0x74
+#define PAGE_BLOCK_SPARE	3		/* blocks ahead of the DMA kept marked, out of reach of readers */
 
 static u32
 gray2binary(u32 gray, u32 bit)
@@ -2585,7 +2650,10 @@ pt3_dma_reset(PT3_DMA *dma)
 		page->data_pos = 0;
 		*page->data = NOT_SYNC_BYTE;
 	}
-	dma->ts_pos = 0;
+	spin_lock(&dma->track);
+	dma->head = 0;
+	dma->gen++;
+	spin_unlock(&dma->track);
 }
 
 void
@@ -2612,6 +2680,8 @@ pt3_dma_set_enabled(PT3_DMA *dma, int enabled)
 		writel( 1 << 0, base + 0x08);
 	} else {
 		PT3_PRINTK(7, KERN_DEBUG, "disable dma real_index=%d\n", dma->real_index);
+		dma->enabled = 0;
+		cancel_delayed_work_sync(&dma->watch);
 		writel(1 << 1, base + 0x08);
 		while (1) {
 			data = readl(base + 0x10);
@@ -2621,94 +2691,211 @@ pt3_dma_set_enabled(PT3_DMA *dma, int enabled)
 		}
 	}
 	dma->enabled = enabled;
+	if (enabled)
+		schedule_delayed_work(&dma->watch, msecs_to_jiffies(DMA_WATCH_MS));
 }
 
-int
-pt3_dma_ready(PT3_DMA *dma)
+// move head on, a block is complete once the DMA has started the next one.
+// the marker goes into the block PAGE_BLOCK_SPARE ahead of head, which no
+// reader may use any more, so filled blocks are never touched and the next
+// lap can still be seen as long as tracking lags less than that many blocks.
+static void
+pt3_dma_track(PT3_DMA *dma)
 {
-	u32 next;
-	PT3_DMA_PAGE *page;
+	u32 n, next;
 	u8 *p;
 
-	next = dma->ts_pos + 1;
-	if (next >= dma->ts_count)
-		next = 0;
+	if (!dma->enabled || !dma->look_ready)
+		return;
+	for (n = 0; n < dma->ts_count - 1; n++) {
+		next = dma->head + 1 < dma->ts_count ? dma->head + 1 : 0;
+		p = &dma->ts_info[next].data[0];
+		if (*p != 0x47) {
+			if (*p != NOT_SYNC_BYTE)
+				PT3_PRINTK(0, KERN_DEBUG, "invalid sync byte value=0x%02x head=%d\n",
+						*p, dma->head);
+			break;
+		}
+		dma->head = next;
+		dma->produced++;
+		dma->ts_info[(next + PAGE_BLOCK_SPARE) % dma->ts_count].data[0] = NOT_SYNC_BYTE;
+	}
+}
 
-	page = &dma->ts_info[next];
-	p = &page->data[page->data_pos];
+// complete blocks the reader has not taken yet
+static u32
+pt3_reader_behind(PT3_DMA *dma, PT3_READER *rd)
+{
+	u64 behind;
 
-	if (*p == 0x47)
-		return 1;
-	if (*p == NOT_SYNC_BYTE)
-		return 0;
+	spin_lock(&dma->track);
+	pt3_dma_track(dma);
+	behind = rd->gen == dma->gen ? dma->produced - rd->seq : 0;
+	spin_unlock(&dma->track);
 
-	PT3_PRINTK(0, KERN_DEBUG, "invalid sync byte value=0x%02x ts_pos=%d data_pos=%d curr=0x%02x\n",
-			*p, next, page->data_pos, dma->ts_info[dma->ts_pos].data[0]);
+	return behind < dma->ts_count ? behind : dma->ts_count;
+}
 
-	return 0;
+// a reader whose blocks are about to be marked or overwritten skips ahead to
+// the middle of the ring, so a slow reader loses data but never holds the DMA
+// or other readers back
+static u32
+pt3_reader_catch_up(PT3_DMA *dma, PT3_READER *rd)
+{
+	u64 behind;
+
+	spin_lock(&dma->track);
+	pt3_dma_track(dma);
+	behind = rd->gen == dma->gen ? dma->produced - rd->seq : 0;
+	if (behind >= dma->ts_count - PAGE_BLOCK_SPARE) {
+		rd->overruns += behind - dma->ts_count / 2;
+		PT3_PRINTK(7, KERN_INFO, "dma buffer overflow. skip %llu blocks\n",
+				behind - dma->ts_count / 2);
+		behind = dma->ts_count / 2;
+		rd->seq = dma->produced - behind;
+		rd->pos = (dma->head + dma->ts_count - behind) % dma->ts_count;
+		rd->data_pos = 0;
+	}
+	spin_unlock(&dma->track);
+
+	return behind;
+}
+
+static void
+pt3_reader_advance(PT3_DMA *dma, PT3_READER *rd, u32 count)
+{
+	spin_lock(&dma->track);
+	rd->seq += count;
+	rd->pos = (rd->pos + count) % dma->ts_count;
+	rd->data_pos = 0;
+	spin_unlock(&dma->track);
+}
+
+// new readers start at the block the DMA is writing
+static void
+pt3_reader_join(PT3_DMA *dma, PT3_READER *rd)
+{
+	spin_lock(&dma->track);
+	rd->gen = dma->gen;
+	rd->seq = dma->produced;
+	rd->pos = dma->head;
+	rd->data_pos = 0;
+	spin_unlock(&dma->track);
+}
+
+static void
+pt3_dma_watch(struct work_struct *work)
+{
+	PT3_DMA *dma = container_of(work, PT3_DMA, watch.work);
+	u64 produced;
+
+	if (!dma->enabled)
+		return;
+	spin_lock(&dma->track);
+	produced = dma->produced;
+	pt3_dma_track(dma);
+	produced = dma->produced - produced;
+	spin_unlock(&dma->track);
+	if (produced)
+		wake_up_interruptible(&dma->wait);
+	schedule_delayed_work(&dma->watch, msecs_to_jiffies(DMA_WATCH_MS));
+}
+
+void
+pt3_dma_get_ring(PT3_DMA *dma, PT3_READER *rd, PT3_RING *ring)
+{
+	mutex_lock(&rd->lock);
+	pt3_reader_catch_up(dma, rd);
+	ring->count = dma->ts_count;
+	ring->size = PAGE_BLOCK_SIZE;
+	ring->head = dma->head;
+	ring->tail = rd->pos;
+	if (!pt3_reader_behind(dma, rd))
+		ring->tail = ring->head;
+	mutex_unlock(&rd->lock);
+}
+
+int
+pt3_dma_release(PT3_DMA *dma, PT3_READER *rd, u32 count)
+{
+	int ret = 0;
+
+	mutex_lock(&rd->lock);
+	if (count > pt3_reader_catch_up(dma, rd))
+		ret = -EINVAL;
+	else
+		pt3_reader_advance(dma, rd, count);
+	mutex_unlock(&rd->lock);
+
+	return ret;
+}
+
+// copy to a user buffer, or to an iov_iter (read_iter / splice) when given one
+static size_t
+pt3_dma_put(char __user *buf, struct iov_iter *to, size_t off, u8 *src, size_t len)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,10,0)
+	if (to)
+		return copy_to_iter(src, len, to);
+#endif
+	return len - copy_to_user(&buf[off], src, len);
 }
 
 ssize_t
-pt3_dma_copy(PT3_DMA *dma, char __user *buf, size_t size, loff_t *ppos, int look_ready)
+pt3_dma_copy(PT3_DMA *dma, PT3_READER *rd, char __user *buf, struct iov_iter *to, size_t size,
+		loff_t *ppos, int nonblock)
 {
-	int ready;
+	long ready;
 	PT3_DMA_PAGE *page;
-	size_t csize, remain;
-	u32 lp;
-	u32 prev;
+	size_t csize, remain, done;
+	u8 *src;
 
-	mutex_lock(&dma->lock);
+	mutex_lock(&rd->lock);
 
-	PT3_PRINTK(7, KERN_DEBUG, "dma_copy ts_pos=0x%x data_pos=0x%x\n",
-				dma->ts_pos, dma->ts_info[dma->ts_pos].data_pos);
+	PT3_PRINTK(7, KERN_DEBUG, "dma_copy pos=0x%x data_pos=0x%x\n", rd->pos, rd->data_pos);
 
 	remain = size;
-	for (;;) {
-		if (likely(look_ready)) {
-			for (lp = 0; lp < 20; lp++) {
-				ready = pt3_dma_ready(dma);
-				if (ready)
-					break;
-				schedule_timeout_interruptible(msecs_to_jiffies(30));
+	while (remain) {
+		if (likely(dma->look_ready)) {
+			ready = pt3_reader_catch_up(dma, rd);
+			if (!ready && nonblock) {
+				if (remain == size) {
+					mutex_unlock(&rd->lock);
+					return -EAGAIN;
+				}
+				goto last;
 			}
 			if (!ready)
+				ready = wait_event_interruptible_timeout(dma->wait,
+						pt3_reader_behind(dma, rd), msecs_to_jiffies(DMA_WAIT_MS));
+			if (ready < 0 && remain == size) {
+				mutex_unlock(&rd->lock);
+				return ready;
+			}
+			if (ready <= 0)
+				goto last;
+			if (!pt3_reader_catch_up(dma, rd))
 				goto last;
-			prev = dma->ts_pos - 1;
-			if (prev < 0 || dma->ts_count <= prev)
-				prev = dma->ts_count - 1;
-			if (dma->ts_info[prev].data[0] != NOT_SYNC_BYTE)
-				PT3_PRINTK(7, KERN_INFO, "dma buffer overflow. prev=%d data=0x%x\n",
-						prev, dma->ts_info[prev].data[0]);
 		}
-		page = &dma->ts_info[dma->ts_pos];
-		for (;;) {
-			if ((page->size - page->data_pos) > remain) {
-				csize = remain;
-			} else {
-				csize = (page->size - page->data_pos);
-			}
-			if (copy_to_user(&buf[size - remain], &page->data[page->data_pos], csize)) {
-				mutex_unlock(&dma->lock);
+		page = &dma->ts_info[rd->pos];
+		csize = min_t(size_t, page->size - rd->data_pos, remain);
+		src = &page->data[rd->data_pos];
+		done = pt3_dma_put(buf, to, size - remain, src, csize);
+		*ppos += done;
+		remain -= done;
+		rd->data_pos += done;
+		if (rd->data_pos >= page->size)
+			pt3_reader_advance(dma, rd, 1);
+		if (done < csize) {
+			if (remain == size) {
+				mutex_unlock(&rd->lock);
 				return -EFAULT;
 			}
-			*ppos += csize;
-			remain -= csize;
-			page->data_pos += csize;
-			if (page->data_pos >= page->size) {
-				page->data_pos = 0;
-				page->data[page->data_pos] = NOT_SYNC_BYTE;
-				dma->ts_pos++;
-				if (dma->ts_pos >= dma->ts_count)
-					dma->ts_pos = 0;
-				break;
-			}
-			if (remain <= 0)
-				goto last;
+			goto last;
 		}
-		// schedule_timeout_interruptible(msecs_to_jiffies(0));
 	}
 last:
-	mutex_unlock(&dma->lock);
+	mutex_unlock(&rd->lock);
 
 	return size - remain;
 }
@@ -2779,7 +2966,10 @@ create_pt3_dma(struct pci_dev *hwdev, PT3_I2C *i2c, int real_index)
 	dma->enabled = 0;
 	dma->i2c = i2c;
 	dma->real_index = real_index;
-	mutex_init(&dma->lock);
+	dma->look_ready = 1;
+	spin_lock_init(&dma->track);
+	init_waitqueue_head(&dma->wait);
+	INIT_DELAYED_WORK(&dma->watch, pt3_dma_watch);
 
 	dma->ts_count = PAGE_BLOCK_COUNT;
 	dma->ts_info = kzalloc(sizeof(PT3_DMA_PAGE) * dma->ts_count, GFP_KERNEL);
@@ -2856,13 +3046,16 @@ MODULE_LICENSE("GPL");
 int debug = 0;		// 1 normal messages, 0 quiet .. 7 verbose
 static int lnb = 0;	// LNB OFF:0 +11V:1 +15V:2
 static int lnb_force = 0; // Force enable LNB
+static int defer_init = 1; // tune each tuner once at its first open instead of at probe
 
 module_param(debug, int, S_IRUGO | S_IWUSR);
 module_param(lnb, int, 0);
 module_param(lnb_force, int, 0);
+module_param(defer_init, int, 0);
 MODULE_PARM_DESC(debug, "debug lvel (0-7)");
 MODULE_PARM_DESC(lnb, "LNB level (0:OFF 1:+11V 2:+15V)");
 MODULE_PARM_DESC(lnb_force, "Force enable LNB");
+MODULE_PARM_DESC(defer_init, "Initial tune of each tuner at its first open instead of at probe (default 1)");
 
 #define VENDOR_ALTERA 0x1172
 #define PCI_PT3_ID    0x4c15
@@ -2897,6 +3090,8 @@ typedef struct _PT3_TUNER {
 	PT3_TC *tc_t;
 	PT3_QM *qm;
 	PT3_MX *mx;
+	int initialized[PT3_ISDB_MAX];	// initial tune done
+	struct mutex lock;		// one tune at a time on ISDB-S / ISDB-T pair
 } PT3_TUNER;
 
 typedef struct _PT3_CHANNEL PT3_CHANNEL;
@@ -2917,7 +3112,10 @@ typedef struct	_pt3_device{
 } PT3_DEVICE;
 
 struct _PT3_CHANNEL {
-	u32		valid ;
+	u32		users ;		// open files, all tuned alike
+	int		started;	// readers after START_REC
+	int		tuned;
+	FREQUENCY	tuned_freq;
 	u32		minor;
 	PT3_TUNER	*tuner;
 	int		type ;
@@ -2925,12 +3123,20 @@ struct _PT3_CHANNEL {
 	PT3_DEVICE	*ptr ;
 	PT3_I2C	*i2c;
 	PT3_DMA	*dma;
+	struct work_struct	tune;		// SET_CHANNEL_ASYNC, state below under lock
+	FREQUENCY	tune_freq;
+	int		tune_state;
+	STATUS		tune_status;
+	u32		tune_seq;	// tunes ended, POLLPRI for readers that have not seen the last
+	unsigned long	tune_start;
+	unsigned long	tune_end;
 };
 
 static int real_channel[MAX_CHANNEL] = {0, 1, 2, 3};
 static int channel_type[MAX_CHANNEL] = {PT3_ISDB_S, PT3_ISDB_S, PT3_ISDB_T, PT3_ISDB_T};
 
 static	PT3_DEVICE	*device[MAX_PCI_DEVICE];
+static	DEFINE_MUTEX(device_lock);	// device[] slots, probes may run in parallel
 static struct class	*pt3video_class;
 
 static int
@@ -3227,11 +3433,25 @@ last:
 	return status;
 }
 
+static STATUS
+init_tuner_freq(int isdb, PT3_TUNER *tuner)
+{
+	STATUS status;
+
+	status = set_frequency(isdb, tuner, (isdb == PT3_ISDB_S) ? 0 : (tuner->tuner_no == 0) ? 70 : 71, 0);
+	if (status) {
+		PT3_PRINTK(0, KERN_DEBUG, "fail set_frequency. status=0x%x\n", status);
+	}
+	tuner->initialized[isdb] = 1;
+	return status;
+}
+
 static STATUS
 init_all_tuner(PT3_DEVICE *dev_conf)
 {
 	STATUS status;
-	int i, j, channel;
+	int i, j;
+	unsigned long t0 = jiffies;
 	PT3_I2C *i2c = dev_conf->i2c;
 	PT3_BUS *bus = create_pt3_bus();
 
@@ -3252,26 +3472,22 @@ init_all_tuner(PT3_DEVICE *dev_conf)
 	status = tuner_power_on(dev_conf, bus);
 	if (status)
 		goto last;
-	PT3_PRINTK(7, KERN_DEBUG, "tuner_power_on\n");
+	PT3_PRINTK(1, KERN_INFO, "tuner_power_on %u ms\n", jiffies_to_msecs(jiffies - t0));
 
+	if (defer_init)
+		goto last;
 	for (i = 0; i < MAX_TUNER; i++) {
 		for (j = 0; j < PT3_ISDB_MAX; j++) {
-			if (j == PT3_ISDB_S)
-				channel = 0;
-			else
-				channel = (i == 0) ? 70 : 71;
 			status = set_tuner_sleep(j, &dev_conf->tuner[i], 0);
 			if (status)
 				goto last;
-			status = set_frequency(j, &dev_conf->tuner[i], channel, 0);
-			if (status) {
-				PT3_PRINTK(0, KERN_DEBUG, "fail set_frequency. status=0x%x\n", status);
-			}
+			init_tuner_freq(j, &dev_conf->tuner[i]);
 			status = set_tuner_sleep(j, &dev_conf->tuner[i], 1);
 			if (status)
 				goto last;
 		}
 	}
+	PT3_PRINTK(1, KERN_INFO, "init_all_tuner %u ms\n", jiffies_to_msecs(jiffies - t0));
 last:
 	free_pt3_bus(bus);
 	return status;
@@ -3386,18 +3602,112 @@ SetChannel(PT3_CHANNEL *channel, FREQUENCY *freq)
 	return STATUS_INVALID_PARAM_ERROR;
 }
 
+static void
+pt3_tune_work(struct work_struct *work)
+{
+	PT3_CHANNEL *channel = container_of(work, PT3_CHANNEL, tune);
+	STATUS status;
+
+	mutex_lock(&channel->tuner->lock);
+	status = SetChannel(channel, &channel->tune_freq);
+	mutex_unlock(&channel->tuner->lock);
+
+	mutex_lock(&channel->lock);
+	channel->tuned = !status;
+	channel->tuned_freq = channel->tune_freq;
+	channel->tune_end = jiffies;
+	channel->tune_status = status;
+	channel->tune_state = status ? PT3_TUNE_FAILED : PT3_TUNE_LOCKED;
+	channel->tune_seq++;
+	mutex_unlock(&channel->lock);
+	PT3_PRINTK(7, KERN_DEBUG, "async tune status=0x%x %u ms\n",
+			status, jiffies_to_msecs(channel->tune_end - channel->tune_start));
+
+	wake_up_interruptible(&channel->dma->wait);
+}
+
+// a shared channel keeps its tuning, 1 if freq asks for the same, -EBUSY if not
+static int
+pt3_tune_shared(PT3_CHANNEL *channel, FREQUENCY *freq)
+{
+	if (channel->users < 2 || !channel->tuned)
+		return 0;
+	if (channel->tuned_freq.frequencyno != freq->frequencyno ||
+		channel->tuned_freq.slot != freq->slot)
+		return -EBUSY;
+	return 1;
+}
+
+static int
+pt3_tune_start(PT3_READER *rd, FREQUENCY *freq)
+{
+	PT3_CHANNEL *channel = rd->channel;
+	int shared;
+
+	mutex_lock(&channel->lock);
+	shared = pt3_tune_shared(channel, freq);
+	if (channel->tune_state == PT3_TUNE_BUSY || shared < 0) {
+		mutex_unlock(&channel->lock);
+		return -EBUSY;
+	}
+	channel->tune_freq = *freq;
+	channel->tune_state = PT3_TUNE_BUSY;
+	channel->tune_status = STATUS_OK;
+	rd->tune_seen = channel->tune_seq;
+	channel->tune_start = jiffies;
+	if (shared) {
+		channel->tune_end = channel->tune_start;
+		channel->tune_state = PT3_TUNE_LOCKED;
+		channel->tune_seq++;
+		mutex_unlock(&channel->lock);
+		wake_up_interruptible(&channel->dma->wait);
+		return 0;
+	}
+	channel->tuned = 0;
+	mutex_unlock(&channel->lock);
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,36)
+	queue_work(system_long_wq, &channel->tune);
+#else
+	schedule_work(&channel->tune);
+#endif
+	return 0;
+}
+
+static void
+pt3_tune_get(PT3_READER *rd, PT3_TUNE_STATUS *ts)
+{
+	PT3_CHANNEL *channel = rd->channel;
+
+	mutex_lock(&channel->lock);
+	ts->state = channel->tune_state;
+	ts->status = channel->tune_status;
+	ts->elapsed = jiffies_to_msecs((channel->tune_state == PT3_TUNE_BUSY ?
+					jiffies : channel->tune_end) - channel->tune_start);
+	if (channel->tune_state == PT3_TUNE_IDLE)
+		ts->elapsed = 0;
+	rd->tune_seen = channel->tune_seq;
+	mutex_unlock(&channel->lock);
+}
+
 static int
 pt3_open(struct inode *inode, struct file *file)
 {
 	int major = imajor(inode);
 	int minor = iminor(inode);
-	int lp, lp2;
+	int lp, lp2, first;
 	PT3_CHANNEL *channel;
+	PT3_READER *rd;
+
+	rd = kzalloc(sizeof(PT3_READER), GFP_KERNEL);
+	if (rd == NULL)
+		return -ENOMEM;
+	mutex_init(&rd->lock);
 
 	for (lp = 0; lp < MAX_PCI_DEVICE; lp++) {
 		if (device[lp] == NULL) {
 			PT3_PRINTK(1, KERN_DEBUG, "device does not exist\n");
-			return -EIO;
+			break;
 		}
 
 		if (MAJOR(device[lp]->dev) == major &&
@@ -3408,21 +3718,34 @@ pt3_open(struct inode *inode, struct file *file)
 			for (lp2 = 0; lp2 < MAX_CHANNEL; lp2++) {
 				channel = device[lp]->channel[lp2];
 				if (channel->minor == minor) {
-					if (channel->valid) {
-						mutex_unlock(&device[lp]->lock);
-						PT3_PRINTK(1, KERN_DEBUG, "device is already used.\n");
-						return -EIO;
+					rd->channel = channel;
+					file->private_data = rd;
+					// the first open wakes the tuner under channel->lock,
+					// taken before users leaves 0 so that sharers wait for it
+					first = !channel->users;
+					if (first)
+						mutex_lock(&channel->lock);
+					channel->users++;
+					mutex_unlock(&device[lp]->lock);
+					if (!first) {
+						PT3_PRINTK(7, KERN_DEBUG, "share tuner_no=%d type=%d users=%d\n",
+								channel->tuner->tuner_no, channel->type, channel->users);
+						mutex_lock(&channel->lock);
+						rd->tune_seen = channel->tune_seq;
+						mutex_unlock(&channel->lock);
+						return 0;
 					}
 					PT3_PRINTK(7, KERN_DEBUG, "selected tuner_no=%d type=%d\n",
 							channel->tuner->tuner_no, channel->type);
 
 					set_tuner_sleep(channel->type, channel->tuner, 0);
 					schedule_timeout_interruptible(msecs_to_jiffies(100));
-
-					channel->valid = 1;
-					file->private_data = channel;
-
-					mutex_unlock(&device[lp]->lock);
+					mutex_lock(&channel->tuner->lock);
+					if (!channel->tuner->initialized[channel->type])
+						init_tuner_freq(channel->type, channel->tuner);
+					mutex_unlock(&channel->tuner->lock);
+					rd->tune_seen = channel->tune_seq;
+					mutex_unlock(&channel->lock);
 
 					return 0;
 				}
@@ -3431,48 +3754,177 @@ pt3_open(struct inode *inode, struct file *file)
 		}
 	}
 
+	kfree(rd);
 	return -EIO;
 }
 
+static void
+pt3_reader_start(PT3_READER *rd)
+{
+	PT3_CHANNEL *channel = rd->channel;
+
+	mutex_lock(&channel->lock);
+	if (!rd->started) {
+		rd->started = 1;
+		if (!channel->started++)
+			pt3_dma_set_enabled(channel->dma, 1);
+	}
+	mutex_unlock(&channel->lock);
+
+	mutex_lock(&rd->lock);
+	pt3_reader_join(channel->dma, rd);
+	mutex_unlock(&rd->lock);
+}
+
+// the DMA runs until the last reader stops, what is left can still be read
+static void
+pt3_reader_stop(PT3_READER *rd)
+{
+	PT3_CHANNEL *channel = rd->channel;
+
+	mutex_lock(&channel->lock);
+	if (rd->started) {
+		rd->started = 0;
+		if (!--channel->started)
+			pt3_dma_set_enabled(channel->dma, 0);
+	}
+	mutex_unlock(&channel->lock);
+}
+
 static int
 pt3_release(struct inode *inode, struct file *file)
 {
-	PT3_CHANNEL *channel = file->private_data;
+	PT3_READER *rd = file->private_data;
+	PT3_CHANNEL *channel = rd->channel;
+	int last;
+
+	pt3_reader_stop(rd);
+	if (rd->overruns)
+		PT3_PRINTK(1, KERN_INFO, "(%d:%d) overrun %u blocks\n",
+				imajor(inode), iminor(inode), rd->overruns);
+	kfree(rd);
 
 	mutex_lock(&channel->ptr->lock);
-	channel->valid = 0;
-	pt3_dma_set_enabled(channel->dma, 0);
+	last = !--channel->users;
+	if (last) {
+		cancel_work_sync(&channel->tune);
+		channel->tune_state = PT3_TUNE_IDLE;
+		channel->tuned = 0;
+		if (channel->dma->enabled)
+			pt3_dma_set_enabled(channel->dma, 0);
+	}
 	mutex_unlock(&channel->ptr->lock);
+	if (!last)
+		return 0;
 
 	if (debug > 0)
 		PT3_PRINTK(0, KERN_INFO, "(%d:%d) error count %d\n",
 				imajor(inode), iminor(inode),
 				pt3_dma_get_ts_error_packet_count(channel->dma));
-	set_tuner_sleep(channel->type, channel->tuner, 1);
-	schedule_timeout_interruptible(msecs_to_jiffies(50));
+	// a first open since then holds channel->lock until the tuner is awake
+	mutex_lock(&channel->lock);
+	if (!channel->users) {
+		set_tuner_sleep(channel->type, channel->tuner, 1);
+		schedule_timeout_interruptible(msecs_to_jiffies(50));
+	}
+	mutex_unlock(&channel->lock);
 
 	return 0;
 }
 
-static int dma_look_ready[MAX_CHANNEL] = {1, 1, 1, 1};
 static ssize_t
 pt3_read(struct file *file, char __user *buf, size_t cnt, loff_t * ppos)
 {
-	size_t rcnt;
-	PT3_CHANNEL *channel;
+	ssize_t rcnt;
+	PT3_READER *rd;
 
-	channel = file->private_data;
+	rd = file->private_data;
 
-	rcnt = pt3_dma_copy(channel->dma, buf, cnt, ppos,
-						dma_look_ready[channel->dma->real_index]);
-	if (rcnt < 0) {
+	rcnt = pt3_dma_copy(rd->channel->dma, rd, buf, NULL, cnt, ppos,
+						file->f_flags & O_NONBLOCK);
+	if (rcnt == -EFAULT)
 		PT3_PRINTK(1, KERN_INFO, "fail copy_to_user.\n");
-		return -EFAULT;
-	}
 
 	return rcnt;
 }
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,10,0)
+// splice() lost its ->read based fallback in 5.10, it needs ->read_iter now
+static ssize_t
+pt3_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	PT3_READER *rd = iocb->ki_filp->private_data;
+
+	return pt3_dma_copy(rd->channel->dma, rd, NULL, to, iov_iter_count(to), &iocb->ki_pos,
+						(iocb->ki_filp->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT));
+}
+#endif
+
+static __poll_t
+pt3_poll(struct file *file, poll_table *wait)
+{
+	PT3_READER *rd = file->private_data;
+	PT3_CHANNEL *channel = rd->channel;
+	PT3_DMA *dma = channel->dma;
+	__poll_t mask = 0;
+
+	poll_wait(file, &dma->wait, wait);
+	if (!dma->look_ready || pt3_reader_behind(dma, rd))
+		mask |= POLLIN | POLLRDNORM;
+	if (rd->tune_seen != channel->tune_seq)
+		mask |= POLLPRI;
+
+	return mask;
+}
+
+// map the whole TS ring read-only, blocks back to back, each block at its
+// own offset of the vma.  a block is linear memory unless the coherent
+// allocator had to remap it, then it goes page by page.  a block is 47 DMA
+// pages, with larger CPU pages they would not line up
+static int
+pt3_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	PT3_READER *rd = file->private_data;
+	PT3_DMA *dma = rd->channel->dma;
+	unsigned long addr;
+	u32 i, off;
+	u8 *p;
+	int ret;
+
+	if (PAGE_SIZE != DMA_PAGE_SIZE)
+		return -EINVAL;
+	if (vma->vm_pgoff ||
+		vma->vm_end - vma->vm_start != (unsigned long)dma->ts_count * PAGE_BLOCK_SIZE)
+		return -EINVAL;
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,3,0)
+	vm_flags_clear(vma, VM_MAYWRITE);
+#else
+	vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+
+	for (i = 0; i < dma->ts_count; i++) {
+		addr = vma->vm_start + (unsigned long)i * PAGE_BLOCK_SIZE;
+		p = dma->ts_info[i].data;
+		if (!is_vmalloc_addr(p)) {
+			ret = remap_pfn_range(vma, addr, page_to_pfn(virt_to_page(p)),
+					dma->ts_info[i].size, vma->vm_page_prot);
+			if (ret)
+				return ret;
+			continue;
+		}
+		for (off = 0; off < dma->ts_info[i].size; off += PAGE_SIZE) {
+			ret = remap_pfn_range(vma, addr + off, vmalloc_to_pfn(p + off),
+					PAGE_SIZE, vma->vm_page_prot);
+			if (ret)
+				return ret;
+		}
+	}
+
+	return 0;
+}
+
 static int
 count_used_bs_tuners(PT3_DEVICE *device)
 {
@@ -3482,7 +3934,7 @@ count_used_bs_tuners(PT3_DEVICE *device)
 	for (i = 0; i < MAX_CHANNEL; i++) {
 		if (device && device->channel[i] &&
 			device->channel[i]->type == PT3_ISDB_S &&
-			device->channel[i]->valid)
+			device->channel[i]->users)
 			count++;
 	}
 
@@ -3494,27 +3946,49 @@ count_used_bs_tuners(PT3_DEVICE *device)
 static long
 pt3_do_ioctl(struct file  *file, unsigned int cmd, unsigned long arg0)
 {
+	PT3_READER *rd;
 	PT3_CHANNEL *channel;
 	FREQUENCY freq;
 	int status, signal, curr_agc, max_agc, lnb_eff, lnb_usr;
 	unsigned int count;
 	unsigned long dummy;
+	PT3_RING ring;
+	PT3_TUNE_STATUS ts;
 	char *voltage[] = {"0V", "11V", "15V"};
 	void *arg;
 
-	channel = file->private_data;
+	rd = file->private_data;
+	channel = rd->channel;
 	arg = (void *)arg0;
 
 	switch (cmd) {
 	case SET_CHANNEL:
-		dummy = copy_from_user(&freq, arg, sizeof(FREQUENCY));
-		status = SetChannel(channel, &freq);
+		// the async tune, waited for, so that one locked path owns the state
+		if (copy_from_user(&freq, arg, sizeof(FREQUENCY)))
+			return -EFAULT;
+		status = pt3_tune_start(rd, &freq);
+		if (status)
+			return status;
+		flush_work(&channel->tune);
+		mutex_lock(&channel->lock);
+		status = channel->tune_status;
+		rd->tune_seen = channel->tune_seq;
+		mutex_unlock(&channel->lock);
 		return -status;
+	case SET_CHANNEL_ASYNC:
+		if (copy_from_user(&freq, arg, sizeof(FREQUENCY)))
+			return -EFAULT;
+		return pt3_tune_start(rd, &freq);
+	case GET_TUNE_STATUS:
+		pt3_tune_get(rd, &ts);
+		if (copy_to_user(arg, &ts, sizeof(PT3_TUNE_STATUS)))
+			return -EFAULT;
+		return 0;
 	case START_REC:
-		pt3_dma_set_enabled(channel->dma, 1);
+		pt3_reader_start(rd);
 		return 0;
 	case STOP_REC:
-		pt3_dma_set_enabled(channel->dma, 0);
+		pt3_reader_stop(rd);
 		return 0;
 	case GET_SIGNAL_STRENGTH:
 		status = get_cn_agc(channel, &signal, &curr_agc, &max_agc);
@@ -3543,6 +4017,9 @@ pt3_do_ioctl(struct file  *file, unsigned int cmd, unsigned long arg0)
 		dummy = copy_to_user(arg, &status, sizeof(int));
 		return 0;
 	case SET_TEST_MODE_ON:
+		if (channel->users > 1)
+			return -EBUSY;
+		channel->dma->look_ready = 0;
 		pt3_dma_build_page_descriptor(channel->dma, 0);
 		PT3_PRINTK(7, KERN_DEBUG, "rebuild dma descriptor.\n");
 		status = (1 + channel->dma->real_index) * 12345;
@@ -3560,11 +4037,13 @@ pt3_do_ioctl(struct file  *file, unsigned int cmd, unsigned long arg0)
 				break;
 			schedule_timeout_interruptible(msecs_to_jiffies(1));
 		}
-		dma_look_ready[channel->dma->real_index] = 0;
+		mutex_lock(&rd->lock);
+		pt3_reader_join(channel->dma, rd);
+		mutex_unlock(&rd->lock);
 		return 0;
 	case SET_TEST_MODE_OFF:
-		dma_look_ready[channel->dma->real_index] = 1;
 		pt3_dma_set_enabled(channel->dma, 0);
+		channel->dma->look_ready = 1;
 		pt3_dma_set_test_mode(channel->dma, 0, 0, 0, 1);
 		pt3_dma_build_page_descriptor(channel->dma, 1);
 		return 0;
@@ -3572,6 +4051,18 @@ pt3_do_ioctl(struct file  *file, unsigned int cmd, unsigned long arg0)
 		count = (int)pt3_dma_get_ts_error_packet_count(channel->dma);
 		dummy = copy_to_user(arg, &count, sizeof(unsigned int));
 		return 0;
+	case GET_RING:
+		pt3_dma_get_ring(channel->dma, rd, &ring);
+		if (copy_to_user(arg, &ring, sizeof(PT3_RING)))
+			return -EFAULT;
+		return 0;
+	case RELEASE_BLOCKS:
+		return pt3_dma_release(channel->dma, rd, (u32)arg0);
+	case GET_OVERRUNS:
+		count = rd->overruns;
+		if (copy_to_user(arg, &count, sizeof(unsigned int)))
+			return -EFAULT;
+		return 0;
 	}
 	return -EINVAL;
 }
@@ -3619,6 +4110,15 @@ static const struct file_operations pt3_fops = {
 	.open		=	pt3_open,
 	.release	=	pt3_release,
 	.read		=	pt3_read,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,5,0)
+	.read_iter	=	pt3_read_iter,
+	.splice_read	=	copy_splice_read,
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(5,10,0)
+	.read_iter	=	pt3_read_iter,
+	.splice_read	=	generic_file_splice_read,
+#endif
+	.poll		=	pt3_poll,
+	.mmap		=	pt3_mmap,
 	.llseek	=	no_llseek,
 #if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,36)
 	.ioctl		=	pt3_ioctl,
@@ -3639,6 +4139,7 @@ pt3_pci_init_one (struct pci_dev *pdev, const struct pci_device_id *ent)
 	PT3_DEVICE	*dev_conf ;
 	PT3_TUNER	*tuner;
 	PT3_CHANNEL	*channel;
+	unsigned long	t0 = jiffies;
 
 	bars = pci_select_bars(pdev, IORESOURCE_MEM);
 	rc = pci_enable_device(pdev);
@@ -3705,6 +4206,7 @@ pt3_pci_init_one (struct pci_dev *pdev, const struct pci_device_id *ent)
 
 		tuner = &dev_conf->tuner[lp];
 		tuner->tuner_no = lp;
+		mutex_init(&tuner->lock);
 		pin = 0;
 		tc_addr = pt3_tc_address(pin, PT3_ISDB_S, lp);
 		tuner_addr = pt3_qm_address(lp);
@@ -3726,6 +4228,7 @@ pt3_pci_init_one (struct pci_dev *pdev, const struct pci_device_id *ent)
 		goto out_err_i2c;
 	}
 
+	mutex_lock(&device_lock);
 	for(lp = 0 ; lp < MAX_PCI_DEVICE ; lp++){
 		PT3_PRINTK(0, KERN_INFO, "device[%d]=%p\n", lp, device[lp]);
 		if(device[lp] == NULL){
@@ -3734,6 +4237,7 @@ pt3_pci_init_one (struct pci_dev *pdev, const struct pci_device_id *ent)
 			break ;
 		}
 	}
+	mutex_unlock(&device_lock);
 
 	rc =alloc_chrdev_region(&dev_conf->dev, 0, MAX_CHANNEL, DEV_NAME);
 	if (rc < 0)
@@ -3763,6 +4267,7 @@ pt3_pci_init_one (struct pci_dev *pdev, const struct pci_device_id *ent)
 		}
 
 		mutex_init(&channel->lock);
+		INIT_WORK(&channel->tune, pt3_tune_work);
 		channel->minor = MINOR(dev_conf->dev) + lp;
 		channel->tuner = &dev_conf->tuner[real_channel[lp] & 1];
 		channel->type  = channel_type[lp];
@@ -3784,6 +4289,8 @@ pt3_pci_init_one (struct pci_dev *pdev, const struct pci_device_id *ent)
 	}
 
 	pci_set_drvdata(pdev, dev_conf);
+	PT3_PRINTK(0, KERN_INFO, "card_number=%d probed in %u ms\n",
+				dev_conf->card_number, jiffies_to_msecs(jiffies - t0));
 	return 0;
 
 out_err_dma:
@@ -3829,6 +4336,7 @@ pt3_pci_remove_one(struct pci_dev *pdev)
 	if(dev_conf){
 		for (lp = 0; lp < MAX_CHANNEL; lp++) {
 			channel = dev_conf->channel[lp];
+			cancel_work_sync(&channel->tune);
 			if (channel->dma->enabled)
 				pt3_dma_set_enabled(channel->dma, 0);
 			set_tuner_sleep(channel->type, channel->tuner, 1);
@@ -3868,7 +4376,9 @@ pt3_pci_remove_one(struct pci_dev *pdev)
 		if (dev_conf->hw_addr[1])
 			iounmap(dev_conf->hw_addr[1]);
 		pci_release_selected_regions(pdev, dev_conf->bars);
+		mutex_lock(&device_lock);
 		device[dev_conf->card_number] = NULL;
+		mutex_unlock(&device_lock);
 		kfree(dev_conf);
 		PT3_PRINTK(0, KERN_DEBUG, "free PT3 DEVICE.\n");
 	}
@@ -12,6 +12,8 @@
 
 #include <linux/pci.h>
 #include <linux/interrupt.h>
+#include <linux/uio.h>
+#include <linux/version.h>
 #include <media/dvb_frontend.h>
 #include "ptx_common.h"
 #include "tc90522.h"
@@ -1263,17 +1265,18 @@ static void pxq3pe_dma_stop(struct pxq3pe_adap *p)
 	card->dma.ON[port] = false;
 }
 
-static ssize_t pxq3pe_read(struct file *file, char *out, size_t maxlen, loff_t *ppos)
+/* read_iter rather than read, so that splice() works too */
+static ssize_t pxq3pe_read_iter(struct kiocb *iocb, struct iov_iter *to)
 {
-	size_t			rlen	= (maxlen / PKT_BYTES) * PKT_BYTES;
-	struct pxq3pe_adap	*p	= file->private_data;
+	size_t			rlen	= (iov_iter_count(to) / PKT_BYTES) * PKT_BYTES;
+	struct pxq3pe_adap	*p	= iocb->ki_filp->private_data;
 	u8			*rbuf	= (u8 *)kzalloc(rlen, GFP_ATOMIC),
 				xor[]	= {0x2F, 0x46, 0x56, 0xE3};
 	int			sz	= p->sBufSize - p->sBufStart,
 				i	= 0,
 				j	= 0;
 
-	if (file && out && rbuf && p->sBufByteCnt >= rlen) {
+	if (rbuf && p->sBufByteCnt >= rlen) {
 		mutex_lock(&p->lock);
 		if (rlen <= sz)
 			memcpy(rbuf, &p->sBuf[p->sBufStart], rlen);
@@ -1298,7 +1301,7 @@ static ssize_t pxq3pe_read(struct file *file, char *out, size_t maxlen, loff_t *
 				rbuf[i] ^= xor[2]; i++;
 			}
 		}
-		sz = copy_to_user(out, rbuf, rlen);
+		rlen = copy_to_iter(rbuf, rlen, to);
 	} else
 		rlen = 0;
 	kfree(rbuf);
@@ -1397,7 +1400,12 @@ static const struct file_operations pxq3pe_fops = {
 	.llseek		= no_llseek,
 	.unlocked_ioctl	= pxq3pe_ioctl,
 	.compat_ioctl	= pxq3pe_ioctl,
-	.read		= pxq3pe_read,
+	.read_iter	= pxq3pe_read_iter,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,5,0)
+	.splice_read	= copy_splice_read,
+#else
+	.splice_read	= generic_file_splice_read,
+#endif
 	.open		= pxq3pe_open,
 	.release	= pxq3pe_release,
 };